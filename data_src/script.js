@@ -15,17 +15,32 @@ document.addEventListener('visibilitychange',()=>{
 });
 fetchStatus();  // Full status only at page load
 
+// GET that waits out the device's bare 503 (too busy, see Retry-After)
+// instead of failing - page load alone fires several requests at once
+async function get(url,tries=4){
+    for(;;){
+        const r=await fetch(url);
+        if(r.status!==503||--tries<=0)return r;
+        await new Promise(ok=>setTimeout(ok,(parseInt(r.headers.get('Retry-After'))||2)*1000));
+    }
+}
+
 async function fetchStatus(){
     try{
-        const r=await fetch('/api/status');
+        const r=await get('/api/status');
         const d=await r.json();
         update(d);
     }catch(e){console.error(e)}
 }
 
+// ETag of the last lite status - unchanged state costs a bodyless 304
+let liteEtag='';
+
 async function fetchStatusLite(){
     try{
-        const r=await fetch('/api/status/lite');
+        const r=await fetch('/api/status/lite',{headers:liteEtag?{'If-None-Match':liteEtag}:{}});
+        if(r.status===304||r.status===503)return;  // Unchanged, or device busy
+        liteEtag=r.headers.get('ETag')||'';
         const d=await r.json();
         updateLite(d);
     }catch(e){console.error(e)}
@@ -119,6 +134,9 @@ function update(d){
     if(d.mqtt&&d.mqtt.host){
         $('#m-host').value=d.mqtt.host;
         $('#m-port').value=d.mqtt.port;
+        $('#m-json').checked=!!d.mqtt.json_state;
+        $('#m-disc').checked=!!d.mqtt.device_discovery;
+        $('#m-tele').value=d.mqtt.telemetry||0;
     }
 }
 
@@ -159,7 +177,7 @@ $('#wifi-form').onsubmit=async e=>{
 $('#mqtt-form').onsubmit=async e=>{
     e.preventDefault();
     try{
-        const r=await fetch('/api/mqtt',{method:'POST',body:new URLSearchParams({host:$('#m-host').value,port:$('#m-port').value,user:$('#m-user').value,password:$('#m-pass').value})});
+        const r=await fetch('/api/mqtt',{method:'POST',body:new URLSearchParams({host:$('#m-host').value,port:$('#m-port').value,user:$('#m-user').value,password:$('#m-pass').value,json_state:$('#m-json').checked?'1':'0',device_discovery:$('#m-disc').checked?'1':'0',telemetry:$('#m-tele').value||0})});
         const d=await r.json();
         alert(d.message||'Saved');
     }catch(e){alert('Error')}
@@ -175,7 +193,7 @@ $('#reset').onclick=async()=>{
 // Password settings
 async function fetchPasswords(){
     try{
-        const r=await fetch('/api/passwords');
+        const r=await get('/api/passwords');
         const d=await r.json();
         $('#ota-status').textContent=d.ota_custom?'(custom set)':'(using default)';
         $('#ap-status').textContent=d.ap_custom?'(custom set)':'(using default)';
@@ -331,7 +349,7 @@ update=function(d){
 // Fetch diagnostic data
 async function fetchDiagnostic(){
     try{
-        const r=await fetch('/api/diagnostic');
+        const r=await get('/api/diagnostic');
         const d=await r.json();
         updateDiagnostic(d);
     }catch(e){console.error(e)}
@@ -454,7 +472,7 @@ try{
 
 async function fetchLogs(){
     try{
-        const r=await fetch('/api/logs');
+        const r=await get('/api/logs');
         const logs=await r.json();
         renderLogs(logs);
     }catch(e){
@@ -533,6 +551,71 @@ $('#logs-section')?.addEventListener('toggle',function(){
     if(this.open)fetchLogs();
 });
 
+// =====================================================
+// History
+// =====================================================
+
+async function fetchHistory(){
+    const hours=$('#history-hours').value;
+    $('#history-csv').href=`/api/history?format=csv&hours=${hours}`;
+    try{
+        const r=await get(`/api/history?format=csv&hours=${hours}`);
+        const rows=(await r.text()).trim().split('\n').slice(1).map(l=>l.split(',').map(Number));
+        drawHistory(rows,hours*3600);
+    }catch(e){
+        console.error(e);
+        $('#history-info').textContent='Error loading history';
+    }
+}
+
+// Columns: time,speed,rpm_min,rpm_avg,rpm_max,rssi,on_pct
+function drawHistory(rows,span){
+    const c=$('#history-chart'),ctx=c.getContext('2d');
+    const w=c.width,h=c.height;
+    ctx.clearRect(0,0,w,h);
+    if(!rows.length){
+        $('#history-info').textContent='No history yet (recorded once time is synced)';
+        return;
+    }
+    const end=Date.now()/1000,start=end-span;
+    const maxRpm=Math.max(1000,...rows.map(r=>r[4]));
+    const x=t=>(t-start)/span*w;
+    const y=v=>h-4-v/maxRpm*(h-8);
+
+    // Fan on-time as bars along the bottom
+    ctx.fillStyle='rgba(34,197,94,0.25)';
+    const bw=Math.max(1,w*60/span);
+    rows.forEach(r=>{if(r[6])ctx.fillRect(x(r[0]),h-r[6]/100*h*0.2,bw,r[6]/100*h*0.2)});
+
+    // Min-max band, then average line; break the line on gaps
+    ctx.strokeStyle='rgba(99,102,241,0.35)';
+    ctx.lineWidth=bw;
+    ctx.beginPath();
+    rows.forEach(r=>{ctx.moveTo(x(r[0]),y(r[2]));ctx.lineTo(x(r[0]),y(r[4]))});
+    ctx.stroke();
+
+    ctx.strokeStyle='#6366f1';
+    ctx.lineWidth=1.5;
+    ctx.beginPath();
+    let prev=0;
+    rows.forEach(r=>{
+        if(r[0]-prev>60)ctx.moveTo(x(r[0]),y(r[3]));else ctx.lineTo(x(r[0]),y(r[3]));
+        prev=r[0];
+    });
+    ctx.stroke();
+
+    const last=rows[rows.length-1];
+    $('#history-info').textContent=`${rows.length} min, peak ${maxRpm} RPM, last ${last[3]} RPM / ${last[5]} dBm`;
+}
+
+$('#refresh-history').onclick=()=>fetchHistory();
+$('#history-hours').onchange=()=>fetchHistory();
+
+// Load history when section is opened
+$('#history-section')?.addEventListener('toggle',function(){
+    if(this.open)fetchHistory();
+});
+
 // =====================================================
 // Update Checker
 // =====================================================
@@ -590,7 +673,7 @@ function updateUpdateUI(d){
 
 async function fetchUpdateStatus(){
     try{
-        const r=await fetch('/api/update/status');
+        const r=await get('/api/update/status');
         const d=await r.json();
         updateUpdateUI(d);
         return d;
@@ -123,13 +123,55 @@
 // ===========================================
 #define MQTT_TOPIC_PREFIX       "rituals_diffuser"
 #define MQTT_DISCOVERY_PREFIX   "homeassistant"
-#define MQTT_RECONNECT_INTERVAL 5000            // 5 seconds
+#define MQTT_RECONNECT_INTERVAL 5000            // 5 seconds, first retry after a failed connect
+#define MQTT_RECONNECT_MAX_INTERVAL 300000      // Backoff doubles per failure up to 5 minutes
+#define MQTT_CONNECT_TIMEOUT_MS 1000            // Max stall of one TCP connect attempt
+#define MQTT_DNS_TIMEOUT_MS     2000            // Max stall of one broker DNS lookup (ESP8266)
 #define MQTT_KEEPALIVE          60              // seconds
+#define MQTT_STATE_CHECK_INTERVAL   30000       // Check for changed state every 30 seconds
+// Everything is retained and republished on connect and on a Home Assistant
+// birth message, so the blind full refresh is only a slow safety net
+#ifndef MQTT_FULL_REFRESH_INTERVAL
+#define MQTT_FULL_REFRESH_INTERVAL  21600000UL  // Republish every state topic every 6 hours (0 = never)
+#endif
+#define MQTT_HA_BIRTH_JITTER_MS     10000       // Spread republish after an HA restart over 0-10 s per device
+#define MQTT_HA_BIRTH_RETAINED_MS   3000        // Birth this soon after subscribing is the retained copy
+// Publish pacing - bursts while the socket keeps up, backs off under backpressure
+#define MQTT_PUBLISH_BURST          8           // Max publishes per loop() pass
+#define MQTT_PACING_SLOW_MS         20          // A publish this slow blocked on a full TCP window
+#define MQTT_PACING_MIN_DELAY       10          // First backoff step (ms)
+#define MQTT_PACING_MAX_DELAY       200         // Backoff cap (ms)
+#define MQTT_PACING_MIN_HEAP        8192        // Pause publishing below this much free heap
+#define MQTT_PACING_FIELD_PACKET    128         // ESP8266: send buffer room for one state field packet
+#define TELEMETRY_INTERVAL_MAX      60          // Slowest telemetry sample period (s), 0 = off
 
 // ===========================================
 // Webserver Settings
 // ===========================================
 #define WEBSERVER_PORT          80
+// index.html references style.css/script.js with a content hash (?v=...),
+// so the assets never go stale and the page itself only needs a short TTL
+#define WEB_ASSET_CACHE_CONTROL "public, max-age=31536000, immutable"
+#define WEB_INDEX_CACHE_CONTROL "max-age=60"
+#define WEB_SETTINGS_BODY_MAX   1024            // Largest /api/settings JSON body
+// Per-route request accounting (/api/diagnostic/routes), 32 bytes per route.
+// Routes beyond the limit are served but not tracked.
+#define WEB_ROUTE_STATS_MAX     44
+#define WEB_SLOW_REQUEST_MS     100             // Log handlers slower than this to Serial (0 = off)
+// Admission control: with more requests in flight than this, or less free
+// heap, requests other than fan control and the page shell get a bare 503
+// + Retry-After
+#ifdef PLATFORM_ESP8266
+    #define WEB_MAX_IN_FLIGHT   3
+    #define WEB_MIN_FREE_HEAP   12000           // Leaves room for the update check's TLS session
+#else
+    #define WEB_MAX_IN_FLIGHT   8
+    #define WEB_MIN_FREE_HEAP   32000
+#endif
+#define WEB_RETRY_AFTER         "2"             // Seconds, sent with the 503
+// /api/fan commands are merged and applied at most this often (slider
+// drags POST every 50ms)
+#define WEB_FAN_COMMAND_TICK_MS 100
 
 // ===========================================
 // OTA Settings
@@ -137,6 +179,13 @@
 #define OTA_HOSTNAME            "rituals-diffuser"
 #define OTA_PASSWORD            "diffuser-ota"
 
+// ===========================================
+// Storage Settings
+// ===========================================
+// Deferred settings are committed once they have been stable this long.
+// Coalesces slider drags (one POST per 50ms) into a single flash write.
+#define STORAGE_COMMIT_QUIET_MS 5000            // 5 seconds
+
 // ===========================================
 // NVS Storage Keys (EEPROM on ESP8266)
 // ===========================================
@@ -147,6 +196,10 @@
 #define NVS_MQTT_PORT           "mqtt_port"
 #define NVS_MQTT_USER           "mqtt_user"
 #define NVS_MQTT_PASS           "mqtt_pass"
+#define NVS_MQTT_JSON_STATE     "mqtt_json"
+#define NVS_MQTT_DEVICE_DISC    "mqtt_dev_disc"
+#define NVS_DISCOVERY_HASH      "disc_hash"
+#define NVS_TELEMETRY           "telemetry"
 #define NVS_DEVICE_NAME         "device_name"
 #define NVS_FAN_SPEED           "fan_speed"
 #define NVS_FAN_MIN_PWM         "fan_min_pwm"
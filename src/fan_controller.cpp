@@ -1,6 +1,8 @@
 #include "fan_controller.h"
 #include "config.h"
 #include "storage.h"
+#include "mqtt_handler.h"
+#include "state_version.h"
 
 // External function from main.cpp for LED status updates
 extern void updateLedStatus();
@@ -73,10 +75,19 @@ void FanController::loop() {
         // Use 64-bit intermediate to prevent overflow with high pulse counts
         if (rpmInterval > 0 && TACHO_PULSES_PER_REV > 0) {
             uint32_t divisor = TACHO_PULSES_PER_REV * rpmInterval;
-            _rpm = (uint16_t)((uint64_t)count * 60000UL / divisor);
+            uint16_t rpm = (uint16_t)((uint64_t)count * 60000UL / divisor);
+            if (rpm != _rpm) bumpStateVersion();
+            _rpm = rpm;
         }
         _lastRpmCalc = now;
 
+        // Remaining timer minutes tick without any call into the controller
+        uint16_t remaining = getRemainingMinutes();
+        if (remaining != _lastRemaining) {
+            _lastRemaining = remaining;
+            bumpStateVersion();
+        }
+
         if (_calibrating) {
             Serial.printf("[FAN] RPM calc: count=%lu, rpm=%d\n", count, _rpm);
         }
@@ -166,6 +177,7 @@ void FanController::loop() {
     // Handle timer (subtraction handles millis() overflow correctly)
     if (_timerActive && (now - _timerStartTime >= _timerDuration)) {
         Serial.println("[FAN] Timer expired");
+        mqttHandler.queueEvent(MQTT_EVENT_TIMER);
         turnOff();
         _timerActive = false;
     }
@@ -293,6 +305,7 @@ void FanController::setTimer(uint16_t minutes) {
         _timerStartTime = millis();
         _timerDuration = minutes * 60000UL;
         _timerActive = true;
+        bumpStateVersion();
         if (!_isOn) turnOn();
         Serial.printf("[FAN] Timer set for %d minutes\n", minutes);
     }
@@ -300,6 +313,7 @@ void FanController::setTimer(uint16_t minutes) {
 
 void FanController::cancelTimer() {
     _timerActive = false;
+    bumpStateVersion();
     Serial.println("[FAN] Timer cancelled");
 }
 
@@ -349,6 +363,7 @@ bool FanController::isIntervalMode() {
 void FanController::setIntervalTimes(uint8_t onSeconds, uint8_t offSeconds) {
     _intervalOnTime = constrain(onSeconds, INTERVAL_MIN, INTERVAL_MAX);
     _intervalOffTime = constrain(offSeconds, INTERVAL_MIN, INTERVAL_MAX);
+    bumpStateVersion();
     Serial.printf("[FAN] Interval times: %ds ON, %ds OFF\n", _intervalOnTime, _intervalOffTime);
 }
 
@@ -462,6 +477,7 @@ void FanController::setMinPWM(uint8_t value) {
 }
 
 void FanController::notifyStateChange() {
+    bumpStateVersion();
     if (_stateCallback) {
         _stateCallback(_isOn, _speed);
     }
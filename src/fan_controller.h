@@ -62,6 +62,7 @@ private:
     static void IRAM_ATTR tachoISR();
     unsigned long _lastRpmCalc = 0;
     uint16_t _rpm = 0;
+    uint16_t _lastRemaining = 0;    // Last reported timer minutes (state version)
 
     // Soft start
     unsigned long _softStartTime = 0;
@@ -0,0 +1,391 @@
+#include "history.h"
+#include "fan_controller.h"
+#include "wifi_manager.h"
+#include <time.h>
+
+#ifdef PLATFORM_ESP8266
+    #include <LittleFS.h>
+    #define FILESYSTEM LittleFS
+#else
+    #include <SPIFFS.h>
+    #define FILESYSTEM SPIFFS
+#endif
+
+History history;
+
+// Sample once per second, aggregate per minute
+#define HISTORY_SAMPLE_INTERVAL_MS 1000
+
+// Write the open block every 15 records (reduce flash wear)
+#define HISTORY_CHECKPOINT_RECORDS 15
+
+// Largest encoded record: mask byte + gap varint + 6 two-byte varints
+#define HISTORY_MAX_RECORD 16
+
+// Longest gap kept inside a block (count is 16 bit)
+#define HISTORY_MAX_SPAN 0xFFFF
+
+// Longest range served by /api/history
+#define HISTORY_MAX_HOURS (HISTORY_SLOTS * 2)
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint8_t putVarint(uint8_t* p, uint32_t v) {
+    uint8_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+// Returns bytes consumed, 0 if the varint runs past end
+static uint8_t getVarint(const uint8_t* p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (uint8_t n = 0; n < 5 && p + n < end; n++) {
+        v |= (uint32_t)(p[n] & 0x7F) << (7 * n);
+        if (!(p[n] & 0x80)) return n + 1;
+    }
+    return 0;
+}
+
+// Decode the record at p, adding its deltas to values. Returns the bytes
+// consumed (0 if it runs past end) and the minutes skipped before it.
+static uint8_t decodeRecord(const uint8_t* p, const uint8_t* end, int32_t* values, uint32_t& skipped) {
+    const uint8_t* start = p;
+    uint8_t mask = *p++;
+    uint32_t v;
+    uint8_t n;
+    skipped = 0;
+    if (mask & HISTORY_GAP) {
+        n = getVarint(p, end, skipped);
+        if (n == 0) return 0;
+        p += n;
+    }
+    for (uint8_t i = 0; i < HISTORY_FIELD_COUNT; i++) {
+        if (!(mask & (1 << i))) continue;
+        n = getVarint(p, end, v);
+        if (n == 0) return 0;
+        values[i] += unzigzag(v);
+        p += n;
+    }
+    return p - start;
+}
+
+static uint32_t epochMinute() {
+    time_t now = time(nullptr);
+    return now > 1000000000 ? (uint32_t)(now / 60) : 0;
+}
+
+static bool readSlot(File& file, uint32_t seq, HistoryBlock& out) {
+    uint32_t offset = (seq % HISTORY_SLOTS) * HISTORY_BLOCK_SIZE;
+    if (offset + HISTORY_BLOCK_SIZE > file.size()) return false;
+    if (!file.seek(offset)) return false;
+    if (file.read((uint8_t*)&out, sizeof(out)) != sizeof(out)) return false;
+    return out.hdr.seq == seq && out.hdr.used <= HISTORY_DATA_SIZE;
+}
+
+void History::begin() {
+    memset(&_block, 0, sizeof(_block));
+    resetMinute();
+
+    memset(_prev, 0, sizeof(_prev));
+
+    // Filesystem is mounted by logger.begin()
+    uint32_t maxSeq = 0;
+    File file = FILESYSTEM.open(HISTORY_FILE_PATH, "r");
+    if (file) {
+        HistoryBlockHeader hdr;
+        uint16_t slots = file.size() / HISTORY_BLOCK_SIZE;
+        for (uint16_t i = 0; i < slots && i < HISTORY_SLOTS; i++) {
+            file.seek((uint32_t)i * HISTORY_BLOCK_SIZE);
+            if (file.read((uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.seq > maxSeq) {
+                maxSeq = hdr.seq;
+            }
+        }
+
+        // Continue the last block while it has room, so a reboot costs a gap
+        // record instead of a fresh, mostly empty block. Replaying it
+        // restores the values the next delta is relative to.
+        if (maxSeq > 0 && readSlot(file, maxSeq, _block) && _block.hdr.count > 0 &&
+            (size_t)_block.hdr.used + HISTORY_MAX_RECORD <= HISTORY_DATA_SIZE) {
+            const uint8_t* p = _block.data;
+            const uint8_t* end = _block.data + _block.hdr.used;
+            uint32_t skipped;
+            while (p < end) {
+                uint8_t n = decodeRecord(p, end, _prev, skipped);
+                if (n == 0) break;
+                p += n;
+            }
+            _block.hdr.used = p - _block.data;
+        } else {
+            memset(&_block, 0, sizeof(_block));
+        }
+        file.close();
+    }
+
+    _block.hdr.seq = maxSeq;
+    _ready = true;
+    Serial.printf("[HISTORY] %d blocks of %d bytes, last seq %lu (%u bytes used)\n",
+                  HISTORY_SLOTS, HISTORY_BLOCK_SIZE, (unsigned long)maxSeq, _block.hdr.used);
+}
+
+void History::loop() {
+    if (!_ready) return;
+
+    unsigned long now = millis();
+    if (now - _lastSample < HISTORY_SAMPLE_INTERVAL_MS) return;
+    _lastSample = now;
+
+    uint32_t minute = epochMinute();
+    if (minute == 0) return;  // No NTP yet
+
+    if (minute != _minute) {
+        if (_samples > 0) finishMinute();
+        resetMinute();
+        _minute = minute;
+    }
+    sample();
+}
+
+void History::sample() {
+    uint16_t rpm = fanController.getRPM();
+    if (_samples == 0 || rpm < _rpmMin) _rpmMin = rpm;
+    if (rpm > _rpmMax) _rpmMax = rpm;
+    _rpmSum += rpm;
+    if (fanController.isOn()) _onSamples++;
+    _speed = fanController.getSpeed();
+    if (wifiManager.isConnected()) {
+        _rssiSum += wifiManager.getRSSI();
+        _rssiSamples++;
+    }
+    _samples++;
+}
+
+void History::resetMinute() {
+    _samples = 0;
+    _onSamples = 0;
+    _rpmMin = 0;
+    _rpmMax = 0;
+    _rpmSum = 0;
+    _rssiSum = 0;
+    _rssiSamples = 0;
+}
+
+void History::startBlock(uint32_t minute) {
+    uint32_t seq = _block.hdr.seq + 1;
+    memset(&_block, 0, sizeof(_block));
+    _block.hdr.seq = seq;
+    _block.hdr.startMinute = minute;
+    memset(_prev, 0, sizeof(_prev));
+}
+
+void History::finishMinute() {
+    int32_t values[HISTORY_FIELD_COUNT];
+    values[HISTORY_SPEED] = _speed;
+    values[HISTORY_RPM_MIN] = _rpmMin;
+    values[HISTORY_RPM_AVG] = _rpmSum / _samples;
+    values[HISTORY_RPM_MAX] = _rpmMax;
+    values[HISTORY_RSSI] = _rssiSamples ? _rssiSum / _rssiSamples : 0;
+    values[HISTORY_ON_PCT] = (uint32_t)_onSamples * 100 / _samples;
+
+    // Minutes without a record (reboot, no NTP) become a gap record. A full
+    // block, a clock that went backwards or a span too long for count
+    // closes the block.
+    HistoryBlockHeader& hdr = _block.hdr;
+    bool open = hdr.count > 0;
+    if (open && (_minute < hdr.startMinute + hdr.count ||
+                 _minute - hdr.startMinute >= HISTORY_MAX_SPAN ||
+                 (size_t)hdr.used + HISTORY_MAX_RECORD > HISTORY_DATA_SIZE)) {
+        checkpoint();
+        open = false;
+    }
+    if (!open) startBlock(_minute);
+    uint32_t skipped = _minute - (hdr.startMinute + hdr.count);
+
+    uint8_t* p = _block.data + hdr.used;
+    uint8_t mask = 0;
+    uint8_t len = 1;
+    if (skipped > 0) {
+        mask |= HISTORY_GAP;
+        len += putVarint(p + len, skipped);
+    }
+    for (uint8_t i = 0; i < HISTORY_FIELD_COUNT; i++) {
+        int32_t delta = values[i] - _prev[i];
+        if (delta == 0) continue;
+        mask |= 1 << i;
+        len += putVarint(p + len, zigzag(delta));
+        _prev[i] = values[i];
+    }
+    p[0] = mask;
+
+    noInterrupts();
+    hdr.used += len;
+    hdr.count += skipped + 1;
+    interrupts();
+
+    if (++_unsaved >= HISTORY_CHECKPOINT_RECORDS) {
+        checkpoint();
+    }
+}
+
+void History::checkpoint() {
+    if (_unsaved == 0 || _block.hdr.seq == 0) return;
+    _unsaved = 0;
+
+    uint32_t offset = (_block.hdr.seq % HISTORY_SLOTS) * HISTORY_BLOCK_SIZE;
+    File file = FILESYSTEM.open(HISTORY_FILE_PATH, FILESYSTEM.exists(HISTORY_FILE_PATH) ? "r+" : "w");
+    if (!file) {
+        Serial.println("[HISTORY] Failed to open file");
+        return;
+    }
+
+    // The ring grows block by block until it wraps; a shorter file (e.g.
+    // after a filesystem upload) is padded with empty slots
+    if (file.size() < offset) {
+        HistoryBlockHeader empty;
+        memset(&empty, 0, sizeof(empty));
+        file.seek(file.size() - file.size() % HISTORY_BLOCK_SIZE);
+        while (file.position() < offset) {
+            file.write((const uint8_t*)&empty, sizeof(empty));
+            for (size_t i = sizeof(empty); i < HISTORY_BLOCK_SIZE; i++) file.write((uint8_t)0);
+        }
+    }
+
+    file.seek(offset);
+    if (file.write((const uint8_t*)&_block, sizeof(_block)) != sizeof(_block)) {
+        Serial.println("[HISTORY] Write failed");
+    }
+    file.close();
+}
+
+// Factory reset: the ring file and the open block go, nothing is written back
+void History::clear() {
+    FILESYSTEM.remove(HISTORY_FILE_PATH);
+
+    noInterrupts();
+    memset(&_block, 0, sizeof(_block));
+    interrupts();
+    memset(_prev, 0, sizeof(_prev));
+    resetMinute();
+    _minute = 0;
+    _unsaved = 0;
+    Serial.println("[HISTORY] Cleared");
+}
+
+void History::snapshot(HistoryBlock& out) {
+    noInterrupts();
+    memcpy(&out, &_block, sizeof(out));
+    interrupts();
+}
+
+HistoryReader::HistoryReader(bool csv, uint16_t hours) : _csv(csv) {
+    if (hours == 0) hours = 24;
+    if (hours > HISTORY_MAX_HOURS) hours = HISTORY_MAX_HOURS;
+    uint32_t now = epochMinute();
+    _sinceMinute = now > (uint32_t)hours * 60 ? now - (uint32_t)hours * 60 : 0;
+
+    _lastSeq = history.getSeq();
+    _seq = _lastSeq >= HISTORY_SLOTS ? _lastSeq - HISTORY_SLOTS + 1 : 1;
+    memset(_values, 0, sizeof(_values));
+
+    if (_csv) {
+        _lineLen = snprintf(_line, sizeof(_line), "time,speed,rpm_min,rpm_avg,rpm_max,rssi,on_pct\n");
+    }
+}
+
+// Load the next block that overlaps the requested range
+bool HistoryReader::loadNext() {
+    File file;
+    while (_seq <= _lastSeq) {
+        uint32_t seq = _seq++;
+        bool ok = false;
+        if (seq == _lastSeq) {
+            // Open block - unless nothing was recorded since boot, then the
+            // last block on flash still has the same seq
+            history.snapshot(_block);
+            ok = _block.hdr.seq == seq && _block.hdr.count > 0;
+        }
+        if (!ok) {
+            if (!file) file = FILESYSTEM.open(HISTORY_FILE_PATH, "r");
+            if (!file) continue;
+            ok = readSlot(file, seq, _block);
+        }
+        if (!ok || _block.hdr.startMinute + _block.hdr.count <= _sinceMinute) continue;
+
+        _pos = 0;
+        _minute = _block.hdr.startMinute;
+        memset(_values, 0, sizeof(_values));
+        return true;
+    }
+    return false;
+}
+
+// Decode the next record of the current block into _line
+bool HistoryReader::nextLine() {
+    while (true) {
+        if (!_loaded || _pos >= _block.hdr.used) {
+            _loaded = loadNext();
+            if (!_loaded) return false;
+            continue;
+        }
+
+        uint32_t skipped;
+        uint8_t len = decodeRecord(_block.data + _pos, _block.data + _block.hdr.used, _values, skipped);
+        if (len == 0) {
+            _pos = _block.hdr.used;  // Truncated block
+            continue;
+        }
+        _pos += len;
+
+        uint32_t minute = _minute + skipped;
+        _minute = minute + 1;
+        if (minute < _sinceMinute) continue;
+
+        int n = snprintf(_line, sizeof(_line), "%lu,%ld,%ld,%ld,%ld,%ld,%ld\n",
+                         (unsigned long)minute * 60,
+                         (long)_values[HISTORY_SPEED], (long)_values[HISTORY_RPM_MIN],
+                         (long)_values[HISTORY_RPM_AVG], (long)_values[HISTORY_RPM_MAX],
+                         (long)_values[HISTORY_RSSI], (long)_values[HISTORY_ON_PCT]);
+        _lineLen = n < (int)sizeof(_line) ? n : sizeof(_line) - 1;
+        _linePos = 0;
+        return true;
+    }
+}
+
+// AwsResponseFiller: returns the bytes written, 0 when done
+size_t HistoryReader::read(uint8_t* buf, size_t maxLen) {
+    size_t written = 0;
+
+    if (!_csv) {
+        while (written < maxLen) {
+            if (!_loaded || _pos >= sizeof(HistoryBlock)) {
+                _loaded = loadNext();
+                if (!_loaded) break;
+            }
+            size_t n = sizeof(HistoryBlock) - _pos;
+            if (n > maxLen - written) n = maxLen - written;
+            memcpy(buf + written, (const uint8_t*)&_block + _pos, n);
+            _pos += n;
+            written += n;
+        }
+        return written;
+    }
+
+    while (written < maxLen) {
+        if (_linePos >= _lineLen && !nextLine()) break;
+        size_t n = _lineLen - _linePos;
+        if (n > maxLen - written) n = maxLen - written;
+        memcpy(buf + written, _line + _linePos, n);
+        _linePos += n;
+        written += n;
+    }
+    return written;
+}
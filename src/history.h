@@ -0,0 +1,128 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Ring file of fixed-size blocks. A record takes 1-13 bytes (13 when every
+// field moves by more than 63), so a block holds at least 38 minutes. The
+// open block reuses the oldest slot, so SLOTS - 1 blocks are on flash:
+//   ESP8266: 40 blocks (20 KB of the 128 KB LittleFS) >= 24h worst case
+//   ESP32:   128 blocks (64 KB of the 128 KB SPIFFS partition, shared with
+//            the web UI and logs) >= 3 days worst case, 7 days while
+//            records average 6 bytes or less (a steady fan takes 2-5)
+#define HISTORY_BLOCK_SIZE      512
+#ifdef PLATFORM_ESP8266
+    #define HISTORY_SLOTS       40
+#else
+    #define HISTORY_SLOTS       128
+#endif
+
+#define HISTORY_FILE_PATH "/history.bin"
+
+struct HistoryBlockHeader {
+    uint32_t seq;           // Block sequence number (0 = empty slot)
+    uint32_t startMinute;   // Epoch minute of the first record
+    uint16_t count;         // Minutes covered from startMinute, including gaps
+    uint16_t used;          // Bytes used in data[]
+};
+
+#define HISTORY_DATA_SIZE (HISTORY_BLOCK_SIZE - sizeof(HistoryBlockHeader))
+
+// Block as stored on flash and served by /api/history?format=bin.
+// Each record is a mask byte followed by a zigzag varint delta for every
+// field whose bit is set; fields without a bit are unchanged. Deltas are
+// relative to the previous record in the same block (the first record of a
+// block is relative to zero), so each block decodes on its own.
+// Records are for consecutive minutes, except that a mask with
+// HISTORY_GAP set is followed first by a varint of minutes skipped (no
+// data, e.g. a reboot) before this record.
+struct HistoryBlock {
+    HistoryBlockHeader hdr;
+    uint8_t data[HISTORY_DATA_SIZE];
+};
+
+enum HistoryField : uint8_t {
+    HISTORY_SPEED = 0,      // Fan speed setting (%)
+    HISTORY_RPM_MIN,
+    HISTORY_RPM_AVG,
+    HISTORY_RPM_MAX,
+    HISTORY_RSSI,           // Average RSSI (dBm)
+    HISTORY_ON_PCT,         // Share of the minute the fan was running (%)
+    HISTORY_FIELD_COUNT
+};
+
+#define HISTORY_GAP 0x80    // Record mask bit: minutes were skipped before it
+
+// Local time-series history. Aggregates fan and WiFi metrics per minute and
+// keeps them in a flash ring file, so the web UI can chart the last day(s)
+// without an external database. Records need NTP time - minutes before the
+// first sync are not recorded. After a reboot the last block is continued.
+// Call checkpoint() before ESP.restart(), or up to 15 minutes are lost.
+class History {
+public:
+    void begin();
+    void loop();
+
+    // Write the open block to flash (e.g. before a reboot)
+    void checkpoint();
+
+    // Delete all stored history (factory reset)
+    void clear();
+
+    // Copy of the open block, for readers outside loop()
+    void snapshot(HistoryBlock& out);
+    uint32_t getSeq() const { return _block.hdr.seq; }
+
+private:
+    HistoryBlock _block;
+    int32_t _prev[HISTORY_FIELD_COUNT];
+    bool _ready = false;
+    uint8_t _unsaved = 0;   // Records not yet written to flash
+
+    // Current minute accumulator
+    uint32_t _minute = 0;
+    unsigned long _lastSample = 0;
+    uint16_t _samples = 0;
+    uint16_t _onSamples = 0;
+    uint16_t _rpmMin = 0;
+    uint16_t _rpmMax = 0;
+    uint32_t _rpmSum = 0;
+    int32_t _rssiSum = 0;
+    uint16_t _rssiSamples = 0;
+    uint8_t _speed = 0;
+
+    void sample();
+    void finishMinute();
+    void startBlock(uint32_t minute);
+    void resetMinute();
+};
+
+// Streams the stored history oldest-first, as CSV or as raw blocks. Holds
+// one block in memory, so any range can be served with a few hundred bytes.
+class HistoryReader {
+public:
+    HistoryReader(bool csv, uint16_t hours);
+    size_t read(uint8_t* buf, size_t maxLen);
+
+private:
+    bool _csv;
+    uint32_t _sinceMinute;
+    uint32_t _seq;          // Next block to load
+    uint32_t _lastSeq;      // Open block, served from RAM
+    HistoryBlock _block;
+    bool _loaded = false;
+    uint16_t _pos = 0;      // Byte offset (bin) or data offset (csv)
+    uint32_t _minute = 0;   // csv: earliest minute of the next record
+    int32_t _values[HISTORY_FIELD_COUNT];
+    char _line[64];
+    uint8_t _lineLen = 0;
+    uint8_t _linePos = 0;
+
+    bool loadNext();
+    bool nextLine();
+};
+
+extern History history;
+
+#endif // HISTORY_H
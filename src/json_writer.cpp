@@ -0,0 +1,217 @@
+#include "json_writer.h"
+#include <math.h>
+
+// Sink for the MessagePack measuring pass
+class NullPrint : public Print {
+public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t*, size_t size) override { return size; }
+};
+static NullPrint nullPrint;
+
+JsonWriter::JsonWriter(Print& out) : _out(out), _format(Format::JSON) {}
+
+JsonWriter::JsonWriter() : _out(nullPrint), _format(Format::MSGPACK_SIZES) {}
+
+JsonWriter::JsonWriter(Print& out, const JsonWriter& sizes) : _out(out), _format(Format::MSGPACK) {
+    memcpy(_sizes, sizes._sizes, sizeof(_sizes));
+}
+
+// Separator and key for the next item at the current level
+void JsonWriter::next(const char* key) {
+    if (_format != Format::JSON) {
+        if (_format == Format::MSGPACK_SIZES && _depth > 0 && _depth <= JSON_WRITER_MAX_DEPTH) {
+            _sizes[_open[_depth - 1]]++;
+        }
+        if (key) packString(key, strlen(key));
+        return;
+    }
+
+    uint16_t bit = 1 << _depth;
+    if (_hasItems & bit) _out.print(',');
+    _hasItems |= bit;
+    if (key) {
+        string(key);
+        _out.print(':');
+    }
+}
+
+void JsonWriter::string(const char* s) {
+    if (_format != Format::JSON) {
+        packString(s, strlen(s));
+        return;
+    }
+
+    _out.print('"');
+    for (const char* p = s; *p; p++) {
+        char c = *p;
+        if (c == '"')           _out.print("\\\"");
+        else if (c == '\\')     _out.print("\\\\");
+        else if (c == '\n')     _out.print("\\n");
+        else if (c == '\r')     _out.print("\\r");
+        else if ((uint8_t)c < 0x20) _out.printf("\\u%04x", c);
+        else                    _out.write(c);
+    }
+    _out.print('"');
+}
+
+void JsonWriter::begin(const char* key, bool array) {
+    if (_depth > 0) next(key);
+
+    if (_format == Format::JSON) {
+        _out.print(array ? '[' : '{');
+        _depth++;
+        _hasItems &= ~(1 << _depth);
+        return;
+    }
+
+    // Containers are numbered in the order they are opened, in both passes
+    uint8_t index = _containers < JSON_WRITER_MAX_CONTAINERS ? _containers++ : JSON_WRITER_MAX_CONTAINERS - 1;
+    if (_format == Format::MSGPACK_SIZES) {
+        _sizes[index] = 0;
+        if (_depth < JSON_WRITER_MAX_DEPTH) _open[_depth] = index;
+    } else {
+        uint8_t size = _sizes[index];
+        if (size < 16) {
+            _out.write((uint8_t)((array ? 0x90 : 0x80) | size));   // fixarray / fixmap
+        } else {
+            packBig(array ? 0xdc : 0xde, size, 2);                  // array16 / map16
+        }
+    }
+    _depth++;
+}
+
+void JsonWriter::end(char close) {
+    _depth--;
+    if (_format == Format::JSON) _out.print(close);
+}
+
+void JsonWriter::beginObject(const char* key) {
+    begin(key, false);
+}
+
+void JsonWriter::endObject() {
+    end('}');
+}
+
+void JsonWriter::beginArray(const char* key) {
+    begin(key, true);
+}
+
+void JsonWriter::endArray() {
+    end(']');
+}
+
+// Type byte followed by a big-endian value
+void JsonWriter::packBig(uint8_t type, uint32_t value, uint8_t bytes) {
+    _out.write(type);
+    for (int8_t shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        _out.write((uint8_t)(value >> shift));
+    }
+}
+
+void JsonWriter::packString(const char* s, size_t len) {
+    if (len < 32) {
+        _out.write((uint8_t)(0xa0 | len));     // fixstr
+    } else if (len < 256) {
+        packBig(0xd9, len, 1);                  // str8
+    } else {
+        packBig(0xda, len, 2);                  // str16
+    }
+    _out.write((const uint8_t*)s, len);
+}
+
+void JsonWriter::packUInt(unsigned long value) {
+    if (value < 128) {
+        _out.write((uint8_t)value);             // positive fixint
+    } else if (value < 256) {
+        packBig(0xcc, value, 1);
+    } else if (value < 65536) {
+        packBig(0xcd, value, 2);
+    } else {
+        packBig(0xce, value, 4);
+    }
+}
+
+void JsonWriter::packInt(long value) {
+    if (value >= 0) {
+        packUInt(value);
+    } else if (value >= -32) {
+        _out.write((uint8_t)value);             // negative fixint
+    } else if (value >= -128) {
+        packBig(0xd0, (uint32_t)value, 1);
+    } else if (value >= -32768) {
+        packBig(0xd1, (uint32_t)value, 2);
+    } else {
+        packBig(0xd2, (uint32_t)value, 4);
+    }
+}
+
+void JsonWriter::add(const char* key, bool value) {
+    next(key);
+    if (_format != Format::JSON) {
+        _out.write((uint8_t)(value ? 0xc3 : 0xc2));
+        return;
+    }
+    _out.print(value ? "true" : "false");
+}
+
+void JsonWriter::add(const char* key, int value) {
+    add(key, (long)value);
+}
+
+void JsonWriter::add(const char* key, unsigned int value) {
+    add(key, (unsigned long)value);
+}
+
+void JsonWriter::add(const char* key, long value) {
+    next(key);
+    if (_format != Format::JSON) {
+        packInt(value);
+        return;
+    }
+    _out.print(value);
+}
+
+void JsonWriter::add(const char* key, unsigned long value) {
+    next(key);
+    if (_format != Format::JSON) {
+        packUInt(value);
+        return;
+    }
+    _out.print(value);
+}
+
+void JsonWriter::add(const char* key, double value, uint8_t decimals) {
+    next(key);
+    if (_format != Format::JSON) {
+        // float32 - plenty for the values reported here
+        float f = value;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        packBig(0xca, bits, 4);
+        return;
+    }
+    if (isnan(value) || isinf(value)) {
+        _out.print("null");
+        return;
+    }
+    _out.printf("%.*f", decimals, value);
+}
+
+void JsonWriter::add(const char* key, const char* value) {
+    next(key);
+    if (value) {
+        string(value);
+    } else if (_format != Format::JSON) {
+        _out.write((uint8_t)0xc0);
+    } else {
+        _out.print("null");
+    }
+}
+
+void JsonWriter::add(const char* key, const IPAddress& value) {
+    char ip[16];
+    snprintf(ip, sizeof(ip), "%u.%u.%u.%u", value[0], value[1], value[2], value[3]);
+    add(key, ip);
+}
@@ -0,0 +1,77 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <Arduino.h>
+
+// Objects and arrays per document, for the MessagePack size pass
+#define JSON_WRITER_MAX_CONTAINERS  32
+#define JSON_WRITER_MAX_DEPTH       8
+
+// Minimal streaming JSON writer. Values go straight to the Print sink (an
+// AsyncResponseStream for HTTP), so a response never needs a JsonDocument
+// or a serialised String copy. Same approach as Logger::streamJson(), with
+// the comma/nesting bookkeeping done once here.
+//
+//   JsonWriter json(*response);
+//   json.beginObject();
+//   json.beginObject("fan");
+//   json.add("on", true);
+//   json.endObject();
+//   json.endObject();
+//
+// Inside arrays pass nullptr as key.
+//
+// The same calls can produce MessagePack. MessagePack needs every map and
+// array size up front, so the document is rendered twice: once into a
+// measuring writer that only counts items, then for real:
+//
+//   JsonWriter sizes;                      // Measuring pass, no output
+//   render(sizes);
+//   JsonWriter msgpack(*response, sizes);  // MessagePack with those sizes
+//   render(msgpack);
+//
+// Both passes must make the same calls; values may differ.
+class JsonWriter {
+public:
+    explicit JsonWriter(Print& out);
+    JsonWriter();
+    JsonWriter(Print& out, const JsonWriter& sizes);
+
+    void beginObject(const char* key = nullptr);
+    void endObject();
+    void beginArray(const char* key = nullptr);
+    void endArray();
+
+    void add(const char* key, bool value);
+    void add(const char* key, int value);
+    void add(const char* key, unsigned int value);
+    void add(const char* key, long value);
+    void add(const char* key, unsigned long value);
+    void add(const char* key, double value, uint8_t decimals = 2);
+    void add(const char* key, const char* value);   // Escaped, nullptr = null
+    void add(const char* key, const IPAddress& value);
+
+private:
+    enum class Format : uint8_t { JSON, MSGPACK_SIZES, MSGPACK };
+
+    Print& _out;
+    Format _format;
+    uint16_t _hasItems = 0;     // JSON: bit per nesting level, needs a comma before the next item
+    uint8_t _depth = 0;
+
+    // MessagePack: item count per container, in the order they were opened
+    uint8_t _sizes[JSON_WRITER_MAX_CONTAINERS];
+    uint8_t _open[JSON_WRITER_MAX_DEPTH];   // Container index per nesting level
+    uint8_t _containers = 0;
+
+    void next(const char* key);
+    void begin(const char* key, bool array);
+    void end(char close);
+    void string(const char* s);
+    void packString(const char* s, size_t len);
+    void packInt(long value);
+    void packUInt(unsigned long value);
+    void packBig(uint8_t type, uint32_t value, uint8_t bytes);
+};
+
+#endif // JSON_WRITER_H
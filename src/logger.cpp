@@ -203,6 +203,7 @@ void Logger::addEntry(LogLevel level, const char* message) {
 
     entry.uptimeMs = millis();
     entry.level = level;
+    _levelCounts[(int)level]++;
 
     // Get epoch time if NTP is synced
     time_t now = time(nullptr);
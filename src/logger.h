@@ -52,6 +52,7 @@ public:
 
     // Get logs
     uint16_t getCount();
+    uint32_t getLevelCount(LogLevel level) const { return _levelCounts[(int)level]; }  // Since boot
     const LogEntry* getEntry(uint16_t index);  // 0 = oldest
 
     // Clear all logs
@@ -73,6 +74,7 @@ private:
     LogEntry _entries[MAX_LOG_ENTRIES];
     uint16_t _head = 0;      // Next write position
     uint16_t _count = 0;     // Number of entries
+    uint32_t _levelCounts[3] = {0};  // Entries logged since boot, per LogLevel
     bool _dirty = false;     // True if logs changed since last save
     bool _urgentSave = false; // True if ERROR/WARN needs immediate save
     unsigned long _lastSave = 0;
@@ -0,0 +1,29 @@
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include <Arduino.h>
+
+// Main loop timing, recorded by loop() in main.cpp. Covers the component
+// loops of one pass, not the delay() that yields to the network stack.
+struct LoopStats {
+    uint32_t count;     // Passes since boot
+    uint64_t totalUs;   // Sum of all pass durations
+    uint32_t maxUs;     // Longest pass since the last takeLoopMax()
+};
+
+extern LoopStats loopStats;
+
+inline void recordLoopTime(uint32_t us) {
+    loopStats.count++;
+    loopStats.totalUs += us;
+    if (us > loopStats.maxUs) loopStats.maxUs = us;
+}
+
+// Longest pass since the previous call, e.g. per metrics scrape
+inline uint32_t takeLoopMax() {
+    uint32_t us = loopStats.maxUs;
+    loopStats.maxUs = 0;
+    return us;
+}
+
+#endif // LOOP_STATS_H
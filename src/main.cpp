@@ -15,6 +15,9 @@
 #include "logger.h"
 #include "update_checker.h"
 #include "button_handler.h"
+#include "telemetry.h"
+#include "history.h"
+#include "loop_stats.h"
 
 #ifdef PLATFORM_ESP8266
 #include "sync_ota.h"
@@ -35,6 +38,9 @@ unsigned long lastNightModeCheck = 0;
 // OTA state tracking
 bool otaInProgress = false;
 
+// Loop timing (/metrics)
+LoopStats loopStats = {0, 0, 0};
+
 // Configure NTP time sync
 void setupTimeSync() {
     // Configure time for Europe/Amsterdam timezone (CET/CEST)
@@ -183,6 +189,11 @@ void onFanStateChange(bool on, uint8_t speed) {
     // other caller.
     mqttHandler.requestStatePublish();
 
+    // Usage event - kept in the outbox while the broker is unreachable
+    char fields[32];
+    snprintf(fields, sizeof(fields), "\"on\":%s,\"speed\":%u", on ? "true" : "false", speed);
+    mqttHandler.queueEvent(MQTT_EVENT_FAN, fields);
+
     // Only save speed if it actually changed (avoid flash wear)
     static uint8_t lastSavedSpeed = 0;
     if (speed != lastSavedSpeed && speed > 0) {
@@ -193,6 +204,8 @@ void onFanStateChange(bool on, uint8_t speed) {
 
 // OTA handlers
 void onOTAStart() {
+    storage.flush();  // Commit deferred settings before flash is rewritten
+    history.checkpoint();
     otaInProgress = true;
     updateLedStatus();
     fanController.turnOff();
@@ -229,6 +242,8 @@ void onRearButton(ButtonEvent event) {
         Serial.println("[MAIN] Restart triggered by button");
         logger.info("Restart triggered by button");
         ledController.showError();  // Flash red to indicate restart
+        storage.flush();
+        history.checkpoint();
         delay(500);
         ESP.restart();
     } else if (event == ButtonEvent::LONG_PRESS) {
@@ -238,6 +253,7 @@ void onRearButton(ButtonEvent event) {
         ledController.showError();
         delay(1000);
         storage.reset();
+        history.clear();
         ESP.restart();
     }
 }
@@ -308,6 +324,12 @@ void setup() {
                            settings.mqttUser, settings.mqttPassword);
     }
 
+    // Opt-in high-resolution telemetry (off unless an interval is configured)
+    telemetry.begin(settings.telemetryInterval);
+
+    // Per-minute history for the web UI chart (records once NTP has synced)
+    history.begin();
+
     // Initialize web server
     webServer.begin();
 
@@ -360,12 +382,15 @@ void loop() {
     }
     #endif
 
+    unsigned long loopStart = micros();
+
     // Run all component loops with strategic yields for ESP8266 stability
     wifiManager.loop();
     yield();
 
     fanController.loop();
     ledController.loop();
+    storage.loop();  // Commit deferred settings once they have settled
 
     otaHandler.loop();
     buttonHandler.loop();
@@ -376,6 +401,8 @@ void loop() {
 
     // Run MQTT loop with extra yield time
     mqttHandler.loop();
+    telemetry.loop();
+    history.loop();
     yield();
 
     // Check for urgent log saves (ERROR/WARN logs need saving)
@@ -407,6 +434,8 @@ void loop() {
     }
 #endif
 
+    recordLoopTime(micros() - loopStart);
+
     // Give async tasks (WiFi, MQTT, WebServer) enough CPU time
     // This prevents the AsyncTCP watchdog timeout
     // ESP32 needs longer delay than ESP8266
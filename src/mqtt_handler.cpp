@@ -5,6 +5,15 @@
 #include "storage.h"
 #include "logger.h"
 #include "update_checker.h"
+#include "state_version.h"
+#include <time.h>
+
+#ifdef PLATFORM_ESP8266
+    #include <lwip/opt.h>   // TCP_SND_BUF
+    #ifndef TCP_SND_BUF
+        #define TCP_SND_BUF (2 * 536)
+    #endif
+#endif
 
 // RFID support for all platforms with RC522_ENABLED
 #if defined(RC522_ENABLED)
@@ -21,16 +30,173 @@ MQTTHandler* MQTTHandler::_instance = nullptr;
 
 // Shared buffers for MQTT payload/topic construction (avoids heap fragmentation)
 // Only used in publish functions which are called sequentially via state machine
-// Fan discovery is largest payload (~614 bytes with 12-char MAC ID)
-static char _mqttBuf[768];
+// Fan discovery is largest payload (~614 bytes with 12-char MAC ID, ~770 in JSON state mode)
+static char _mqttBuf[1024];
 static char _mqttTopic[96];
 
+// Topic suffix per MqttStateField (appended to the base topic)
+static const char* const STATE_FIELD_TOPICS[MQTT_FIELD_COUNT] = {
+    "/fan/state",
+    "/fan/speed",
+    "/fan/preset",
+    "/interval/state",
+    "/interval_on/state",
+    "/interval_off/state",
+    "/remaining_time",
+    "/rpm",
+    "/wifi_signal",
+    "/total_runtime",
+    "/update_available",
+    "/latest_version",
+    "/current_version",
+    "/scent",
+    "/cartridge_present"
+};
+
+// Discovery component and object ID suffix per MqttEntity
+// (per-entity topic: <prefix>/<component>/rd_<id><suffix>/config)
+static const struct {
+    const char* component;
+    const char* suffix;
+} DISCOVERY_ENTITIES[MQTT_ENTITY_COUNT] = {
+    {"fan", ""},
+    {"switch", "_int"},
+    {"number", "_ion"},
+    {"number", "_ioff"},
+    {"sensor", "_rem"},
+    {"sensor", "_rpm"},
+    {"sensor", "_wifi"},
+    {"sensor", "_trun"},
+    {"binary_sensor", "_upd"},
+    {"sensor", "_latver"},
+    {"sensor", "_curver"},
+    {"sensor", "_scent"},
+    {"binary_sensor", "_cartridge"}
+};
+
+// queueEvent() runs on whatever task changed the fan - the async_tcp task
+// for web requests - while loop() pops and confirms. On dual-core ESP32
+// noInterrupts() only masks the calling core, so the ring needs a spinlock.
+#ifndef PLATFORM_ESP8266
+static portMUX_TYPE outboxMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+static inline void lockOutbox() {
+#ifdef PLATFORM_ESP8266
+    noInterrupts();
+#else
+    portENTER_CRITICAL(&outboxMux);
+#endif
+}
+
+static inline void unlockOutbox() {
+#ifdef PLATFORM_ESP8266
+    interrupts();
+#else
+    portEXIT_CRITICAL(&outboxMux);
+#endif
+}
+
+// "ev" value per MqttEventType
+static const char* const EVENT_NAMES[MQTT_EVENT_COUNT] = {
+    "fan",
+    "timer",
+    "cartridge"
+};
+
+// Command topic suffixes (after the base topic), indexed by MqttCommand.
+// Drives both the subscriptions and the dispatch in handleMessage().
+#define MQTT_COMMAND(s) { s, sizeof(s) - 1 }
+static const struct {
+    const char* suffix;
+    uint8_t len;
+} COMMAND_TOPICS[MQTT_CMD_COUNT] = {
+    MQTT_COMMAND("/fan/set"),
+    MQTT_COMMAND("/fan/speed/set"),
+    MQTT_COMMAND("/fan/preset/set"),
+    MQTT_COMMAND("/interval/set"),
+    MQTT_COMMAND("/interval_on/set"),
+    MQTT_COMMAND("/interval_off/set")
+};
+
+// Parse a non-negative decimal integer in place, without allocation.
+// A fractional part ("30.0" from HA number entities) is truncated.
+// Returns false for empty, non-numeric or out-of-range (> maxValue) input.
+static bool parseBoundedInt(const char* s, long maxValue, long& out) {
+    const char* p = s;
+    long value = 0;
+    while (*p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        if (value > maxValue) return false;
+        p++;
+    }
+    if (p == s) return false;
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    if (*p != '\0') return false;
+    out = value;
+    return true;
+}
+
+// Key per MqttStateField in the JSON state payload; numeric fields are
+// emitted unquoted so HA templates see numbers
+static const struct {
+    const char* key;
+    bool numeric;
+} STATE_JSON_KEYS[MQTT_FIELD_COUNT] = {
+    {"fan", false},
+    {"speed", true},
+    {"preset", false},
+    {"interval", false},
+    {"interval_on", true},
+    {"interval_off", true},
+    {"remaining", true},
+    {"rpm", true},
+    {"rssi", true},
+    {"runtime", true},
+    {"update", false},
+    {"latest", false},
+    {"version", false},
+    {"scent", false},
+    {"cartridge", false}
+};
+
+// Format the state topic attribute of a discovery config for one field.
+// Default mode: "<topicKey>":"<base>/<field topic>"
+// JSON mode:    "<topicKey>":"<base>/state","<tplKey>":"{{value_json.<key>}}"
+static void formatStateTopic(char* out, size_t len, const char* base, uint8_t field,
+                             bool json, const char* topicKey, const char* tplKey) {
+    if (json) {
+        snprintf(out, len, "\"%s\":\"%s/state\",\"%s\":\"{{value_json.%s}}\"",
+                 topicKey, base, tplKey, STATE_JSON_KEYS[field].key);
+    } else {
+        snprintf(out, len, "\"%s\":\"%s%s\"", topicKey, base, STATE_FIELD_TOPICS[field]);
+    }
+}
+
+// FNV-1a - cheap fingerprint of a payload, so we don't keep every last
+// published string around just to detect changes. Pass a previous hash as
+// seed to fingerprint several strings as one.
+static uint32_t payloadHash(const char* s, uint32_t hash = 2166136261UL) {
+    while (*s) {
+        hash ^= (uint8_t)*s++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
 void MQTTHandler::begin() {
     _instance = this;
 
-    // Set socket timeout to prevent blocking for 15+ seconds when broker is offline
-    // This limits the connect() blocking time to ~3 seconds
+    // Set socket timeout to prevent blocking for 15+ seconds when broker is offline.
+    // ESP8266 uses it to bound the TCP connect, ESP32 gets the limit passed to connect()
+    #ifdef PLATFORM_ESP8266
+    _wifiClient.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
+    #else
     _wifiClient.setTimeout(3000);
+    #endif
 
     _mqttClient.setClient(_wifiClient);
     _mqttClient.setCallback(mqttCallback);
@@ -38,8 +204,9 @@ void MQTTHandler::begin() {
     _mqttClient.setSocketTimeout(3);  // 3 second socket timeout for PubSubClient operations
     // ESP8266 has limited RAM, but fan discovery needs ~613 bytes + MQTT header (~50 bytes)
     // Total MQTT packet: header + topic length + topic + payload = ~663 bytes
+    // JSON state mode adds value templates, pushing the fan discovery packet to ~820 bytes
     #ifdef PLATFORM_ESP8266
-    _mqttClient.setBufferSize(768);
+    _mqttClient.setBufferSize(1024);
     #else
     _mqttClient.setBufferSize(1536);  // Larger buffer for discovery payloads
     #endif
@@ -50,62 +217,25 @@ void MQTTHandler::begin() {
     char id[13];
     snprintf(id, sizeof(id), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     _deviceId = id;
+    snprintf(_baseTopic, sizeof(_baseTopic), "%s_%s", MQTT_TOPIC_PREFIX, id);
+
+    memset(_publishedHash, 0, sizeof(_publishedHash));
+
+    // Derived from the MAC so a fleet answers an HA restart spread out, not all at once
+    _birthJitter = payloadHash(id) % MQTT_HA_BIRTH_JITTER_MS;
 
     Serial.println("[MQTT] Handler initialized");
 }
 
 void MQTTHandler::loop() {
-    if (!_mqttClient.connected()) {
-        unsigned long now = millis();
-        if (now - _lastReconnect >= MQTT_RECONNECT_INTERVAL) {
-            _lastReconnect = now;
-            if (_host.length() > 0 && wifiManager.isConnected()) {
-                Serial.println("[MQTT] Attempting connection...");
-                String clientId = "rituals-" + _deviceId;
-
-                // Build LWT topic
-                char base[48];
-                snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, _deviceId.c_str());
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/availability", base);
-
-                // Pass nullptr for empty credentials so PubSubClient omits the
-                // username/password flags entirely (required by brokers that enforce
-                // anonymous-only access).
-                const char* user = _user.length() > 0 ? _user.c_str() : nullptr;
-                const char* pass = _password.length() > 0 ? _password.c_str() : nullptr;
-                if (_mqttClient.connect(clientId.c_str(), user, pass,
-                                        _mqttTopic, 0, true, "offline")) {
-                    Serial.println("[MQTT] Connected");
-                    logger.infof("MQTT connected to %s:%d", _host.c_str(), _port);
-
-                    publishAvailability(true);
-
-                    // Start discovery state machine (non-blocking)
-                    if (!_discoveryPublished) {
-                        _publishState = MqttPublishState::DISC_FAN;
-                        _lastPublishStep = millis();
-                        Serial.println("[MQTT] Starting discovery publish...");
-                    } else {
-                        // Just publish state
-                        _publishState = MqttPublishState::STATE_FAN;
-                        _lastPublishStep = millis();
-                    }
+    bool connected = _mqttClient.connected();
+    if (connected != _wasConnected) {
+        _wasConnected = connected;
+        bumpStateVersion();  // Status dot in the web UI
+    }
 
-                    // Subscribe to command topics using shared buffer
-                    const char* subSuffixes[] = {
-                        "/fan/set", "/fan/speed/set", "/fan/preset/set",
-                        "/interval/set", "/interval_on/set", "/interval_off/set"
-                    };
-                    for (size_t i = 0; i < sizeof(subSuffixes) / sizeof(subSuffixes[0]); i++) {
-                        snprintf(_mqttTopic, sizeof(_mqttTopic), "%s%s", base, subSuffixes[i]);
-                        _mqttClient.subscribe(_mqttTopic);
-                    }
-                } else {
-                    Serial.printf("[MQTT] Connection failed, rc=%d\n", _mqttClient.state());
-                    logger.errorf("MQTT connection failed (rc=%d)", _mqttClient.state());
-                }
-            }
-        }
+    if (!connected) {
+        processConnect();
     } else {
         _mqttClient.loop();
 
@@ -121,244 +251,532 @@ void MQTTHandler::loop() {
         }
         interrupts();
         if (shouldPublish) {
-            _publishState = MqttPublishState::STATE_FAN;
-            _lastPublishStep = millis();
+            startStatePublish(false);
         }
 
-        // Publish state periodically
+        // Deliver queued events in order, one per step; a failed publish stays queued
         unsigned long now = millis();
-        if (now - _lastStatePublish >= 30000 && _publishState == MqttPublishState::IDLE) {
-            _publishState = MqttPublishState::STATE_FAN;
-            _lastPublishStep = millis();
+        confirmOutbox();
+        if (_outboxSent < _outboxCount && now - _lastOutboxSend >= _publishDelay) {
+            _lastOutboxSend = now;
+            flushOutbox();
+        }
+
+        // Home Assistant restarted: it reloads the retained configs from the
+        // broker, so discovery only goes out again if it no longer matches
+        // what was stored as published. Every state topic is sent either way.
+        if (_birthPending && now - _birthTime >= _birthJitter && _publishState == MqttPublishState::IDLE) {
+            _birthPending = false;
+            _lastFullRefresh = now;
+            if (discoveryHash() == storage.getSettings().discoveryHash) {
+                startStatePublish(true);
+            } else {
+                startDiscovery();
+            }
+        }
+
+        // Periodically pick up values that change without an event (RPM, RSSI,
+        // remaining time). A slow full refresh is kept as a safety net.
+        if (now - _lastStatePublish >= MQTT_STATE_CHECK_INTERVAL && _publishState == MqttPublishState::IDLE) {
+            bool full = (MQTT_FULL_REFRESH_INTERVAL > 0 &&
+                         now - _lastFullRefresh >= MQTT_FULL_REFRESH_INTERVAL);
+            if (full) _lastFullRefresh = now;
+            startStatePublish(full);
             _lastStatePublish = now;
         }
     }
 }
 
+// Connection state machine. PubSubClient needs a synchronous Client, so the
+// phases are not truly asynchronous: each one is a blocking call, run in its
+// own loop() pass with a bound, and attempts are spaced by exponential
+// backoff with jitter. Worst case stall per pass:
+//   RESOLVE    MQTT_DNS_TIMEOUT_MS on ESP8266; the ESP32 core has no bound
+//              (lookups are cached until a connect fails, IP literals are free)
+//   TCP        MQTT_CONNECT_TIMEOUT_MS
+//   HANDSHAKE  the 3 s PubSubClient socket timeout waiting for CONNACK, only
+//              when the broker accepts TCP but does not answer
+// The time actually spent is reported as mqtt.blocked_ms in /api/diagnostic.
+void MQTTHandler::processConnect() {
+    unsigned long now = millis();
+
+    switch (_connState) {
+        case MqttConnState::WAIT:
+            if (_host.length() == 0) return;
+            if (!wifiManager.isConnected()) {
+                // Broker failures say nothing about the next WiFi session -
+                // try as soon as it is back
+                _backoff = 0;
+                _reconnectDelay = 0;
+                return;
+            }
+            if (now - _lastReconnect < _reconnectDelay) return;
+            _lastReconnect = now;
+            _connectAttempts++;
+            Serial.println("[MQTT] Attempting connection...");
+            _connState = _brokerIpValid ? MqttConnState::TCP : MqttConnState::RESOLVE;
+            break;
+
+        case MqttConnState::RESOLVE:
+            // Resolved once and reused until a connect fails (no-op for IP literals)
+            {
+                unsigned long start = millis();
+#ifdef PLATFORM_ESP8266
+                bool ok = WiFi.hostByName(_host.c_str(), _brokerIp, MQTT_DNS_TIMEOUT_MS);
+#else
+                bool ok = WiFi.hostByName(_host.c_str(), _brokerIp);
+#endif
+                _connectBlockedMs += millis() - start;
+                if (!ok) {
+                    Serial.printf("[MQTT] Cannot resolve %s\n", _host.c_str());
+                    connectFailed(-2);  // MQTT_CONNECT_FAILED
+                    return;
+                }
+                _brokerIpValid = true;
+                _connState = MqttConnState::TCP;
+            }
+            break;
+
+        case MqttConnState::TCP:
+            {
+                // PubSubClient::connect() reuses an already open socket
+                unsigned long start = millis();
+#ifdef PLATFORM_ESP8266
+                int ok = _wifiClient.connect(_brokerIp, _port);
+#else
+                int ok = _wifiClient.connect(_brokerIp, _port, MQTT_CONNECT_TIMEOUT_MS);
+#endif
+                _connectBlockedMs += millis() - start;
+                if (!ok) {
+                    _wifiClient.stop();
+                    connectFailed(-2);  // MQTT_CONNECT_FAILED
+                    return;
+                }
+                _connState = MqttConnState::HANDSHAKE;
+            }
+            break;
+
+        case MqttConnState::HANDSHAKE:
+            {
+                String clientId = "rituals-" + _deviceId;
+                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/availability", _baseTopic);
+
+                // Pass nullptr for empty credentials so PubSubClient omits the
+                // username/password flags entirely (required by brokers that enforce
+                // anonymous-only access).
+                const char* user = _user.length() > 0 ? _user.c_str() : nullptr;
+                const char* pass = _password.length() > 0 ? _password.c_str() : nullptr;
+                unsigned long start = millis();
+                bool ok = _mqttClient.connect(clientId.c_str(), user, pass,
+                                              _mqttTopic, 0, true, "offline");
+                _connectBlockedMs += millis() - start;
+                if (!ok) {
+                    connectFailed(_mqttClient.state());
+                    return;
+                }
+                _lastConnectMs = millis() - _lastReconnect;
+                _backoff = 0;
+                _reconnectDelay = MQTT_RECONNECT_INTERVAL;
+                _connState = MqttConnState::WAIT;
+                onConnected();
+            }
+            break;
+    }
+}
+
+void MQTTHandler::connectFailed(int rc) {
+    Serial.printf("[MQTT] Connection failed, rc=%d\n", rc);
+    logger.errorf("MQTT connection failed (rc=%d)", rc);
+
+    _connectFailures++;
+    _brokerIpValid = false;  // Re-resolve next time, the broker may have moved
+    _connState = MqttConnState::WAIT;
+
+    // 5 s, 10 s, 20 s ... capped, plus up to 25% jitter so a fleet doesn't
+    // hammer a recovering broker in lockstep
+    _backoff = _backoff ? min(_backoff * 2, (unsigned long)MQTT_RECONNECT_MAX_INTERVAL)
+                        : (unsigned long)MQTT_RECONNECT_INTERVAL;
+    _reconnectDelay = _backoff + random(_backoff / 4 + 1);
+}
+
+void MQTTHandler::onConnected() {
+    Serial.printf("[MQTT] Connected in %lu ms\n", _lastConnectMs);
+    logger.infof("MQTT connected to %s:%d", _host.c_str(), _port);
+
+    publishAvailability(true);
+
+    // Events written on the old connection were never confirmed - send them
+    // again, with the same seq
+    lockOutbox();
+    uint8_t replay = _outboxSent;
+    _outboxSent = 0;
+    unlockOutbox();
+    if (replay > 0) Serial.printf("[MQTT] Replaying %d unconfirmed events\n", replay);
+
+    // Retained state may be stale after a broker outage - send everything once
+    _forceFullRefresh = true;
+    _lastFullRefresh = millis();
+    _birthPending = false;  // Covered by the publish below
+
+    // Retained configs on the broker are still current if nothing they
+    // depend on changed since the last complete publish
+    if (!_discoveryPublished && discoveryHash() == storage.getSettings().discoveryHash) {
+        _discoveryPublished = true;
+        Serial.println("[MQTT] Discovery unchanged, skipping publish");
+    }
+
+    // Start discovery state machine (non-blocking)
+    if (!_discoveryPublished) {
+        startDiscovery();
+        Serial.println("[MQTT] Starting discovery publish...");
+    } else {
+        // Just publish state
+        _publishState = MqttPublishState::IDLE;
+        startStatePublish(true);
+    }
+
+    // Subscribe to command topics using shared buffer
+    for (uint8_t i = 0; i < MQTT_CMD_COUNT; i++) {
+        snprintf(_mqttTopic, sizeof(_mqttTopic), "%s%s", _baseTopic, COMMAND_TOPICS[i].suffix);
+        _mqttClient.subscribe(_mqttTopic);
+    }
+    // Home Assistant birth/last will - republish discovery when it restarts
+    _mqttClient.subscribe(MQTT_DISCOVERY_PREFIX "/status");
+    _subscribedAt = millis();
+}
+
+// Adaptive pacing: steps run back-to-back while the link keeps up and back
+// off exponentially when it doesn't, instead of a fixed gap sized for the
+// worst case. Backpressure signals are low heap, a nearly full TCP send
+// buffer (ESP8266 reports the free window) and a publish that blocked in
+// write() because the window was full (both platforms).
 void MQTTHandler::processPublishStateMachine() {
     if (_publishState == MqttPublishState::IDLE) return;
     if (!_mqttClient.connected()) {
         _publishState = MqttPublishState::IDLE;
+        _runActive = false;
         return;
     }
 
     unsigned long now = millis();
-    if (now - _lastPublishStep < PUBLISH_STEP_DELAY) return;
+    if (now - _lastPublishStep < _publishDelay) return;
 
-    _lastPublishStep = now;
-
-    // Build base topic into stack buffer (avoids String allocation every step)
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, _deviceId.c_str());
-
-    switch (_publishState) {
-        // Discovery states
-        case MqttPublishState::DISC_FAN:
-            publishFanDiscovery();
-            _publishState = MqttPublishState::DISC_INTERVAL_SWITCH;
-            break;
-
-        case MqttPublishState::DISC_INTERVAL_SWITCH:
-            publishIntervalSwitchDiscovery();
-            _publishState = MqttPublishState::DISC_INTERVAL_ON;
-            break;
+    if (!_runActive) {
+        _runActive = true;
+        _runStart = now;
+        _runSteps = 0;
+    }
 
-        case MqttPublishState::DISC_INTERVAL_ON:
-            publishIntervalOnTimeDiscovery();
-            _publishState = MqttPublishState::DISC_INTERVAL_OFF;
+    // Bounded burst so buttons, LEDs and the tacho still get their turn
+    for (uint8_t i = 0; i < MQTT_PUBLISH_BURST && _publishState != MqttPublishState::IDLE; i++) {
+        if (!publishRoom()) {
+            publishStalled();
             break;
-
-        case MqttPublishState::DISC_INTERVAL_OFF:
-            publishIntervalOffTimeDiscovery();
-            _publishState = MqttPublishState::DISC_REMAINING;
+        }
+        unsigned long start = millis();
+        publishStep();
+        _runSteps++;
+        if (millis() - start >= MQTT_PACING_SLOW_MS) {
+            publishStalled();
             break;
+        }
+        _publishDelay /= 2;  // Link keeps up - speed back up
+    }
+    _lastPublishStep = millis();
 
-        case MqttPublishState::DISC_REMAINING:
-            publishRemainingTimeSensorDiscovery();
-            _publishState = MqttPublishState::DISC_RPM;
-            break;
+    if (_publishState == MqttPublishState::IDLE) {
+        _runActive = false;
+        _lastRunMs = _lastPublishStep - _runStart;
+        _lastRunSteps = _runSteps;
+    }
 
-        case MqttPublishState::DISC_RPM:
-            publishRPMSensorDiscovery();
-            _publishState = MqttPublishState::DISC_WIFI;
-            break;
+    // Give system time after each burst
+    _mqttClient.loop();
+}
 
-        case MqttPublishState::DISC_WIFI:
-            publishWiFiSensorDiscovery();
-            _publishState = MqttPublishState::DISC_RUNTIME;
+bool MQTTHandler::publishRoom() {
+    if (ESP.getFreeHeap() < MQTT_PACING_MIN_HEAP) return false;
+#ifdef PLATFORM_ESP8266
+    // Unacked bytes still occupy the send buffer; wait until the next packet
+    // fits. The whole buffer is only TCP_SND_BUF (2 x 536 with the default
+    // low-memory lwIP), so a larger packet waits for an empty buffer instead.
+    size_t need;
+    switch (_publishState) {
+        case MqttPublishState::STATE_FIELDS:
+            need = MQTT_PACING_FIELD_PACKET;
             break;
-
-        case MqttPublishState::DISC_RUNTIME:
-            publishTotalRuntimeSensorDiscovery();
-            _publishState = MqttPublishState::DISC_UPDATE_AVAILABLE;
+        case MqttPublishState::DISC_DEVICE:
+        case MqttPublishState::DISC_ENTITY:
+        case MqttPublishState::STATE_JSON:
+            need = _mqttClient.getBufferSize();
             break;
-
-        case MqttPublishState::DISC_UPDATE_AVAILABLE:
-            publishUpdateAvailableBinarySensorDiscovery();
-            _publishState = MqttPublishState::DISC_LATEST_VERSION;
+        default:
+            need = 0;   // Bookkeeping step, nothing is sent
             break;
+    }
+    if (need > TCP_SND_BUF) need = TCP_SND_BUF;
+    if (_wifiClient.availableForWrite() < need) return false;
+#endif
+    return true;
+}
 
-        case MqttPublishState::DISC_LATEST_VERSION:
-            publishLatestVersionSensorDiscovery();
-            _publishState = MqttPublishState::DISC_CURRENT_VERSION;
-            break;
+void MQTTHandler::publishStalled() {
+    _publishStalls++;
+    _publishDelay = constrain(_publishDelay * 2, (unsigned long)MQTT_PACING_MIN_DELAY,
+                              (unsigned long)MQTT_PACING_MAX_DELAY);
+}
 
-        case MqttPublishState::DISC_CURRENT_VERSION:
-            publishCurrentVersionSensorDiscovery();
-            _publishState = MqttPublishState::DISC_SCENT;
-            break;
+// One state machine step - at most one publish (or one streamed discovery)
+void MQTTHandler::publishStep() {
+    // Build base topic into stack buffer (avoids String allocation every step)
+    char base[48];
+    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, _deviceId.c_str());
 
-        case MqttPublishState::DISC_SCENT:
-            #if defined(RC522_ENABLED)
-            publishScentSensorDiscovery();
-            #endif
-            _publishState = MqttPublishState::DISC_CARTRIDGE;
+    switch (_publishState) {
+        // Discovery states
+        case MqttPublishState::DISC_DEVICE:
+            // Drop per-entity configs from an earlier fallback install, otherwise
+            // HA ignores the components as duplicate unique IDs
+            if (_discoveryCleanup) {
+                for (uint8_t i = 0; i < MQTT_ENTITY_COUNT; i++) {
+                    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/%s/rd_%s%s/config", MQTT_DISCOVERY_PREFIX,
+                             DISCOVERY_ENTITIES[i].component, _deviceId.c_str(), DISCOVERY_ENTITIES[i].suffix);
+                    _mqttClient.publish(_mqttTopic, "", true);
+                }
+            }
+            if (!publishDeviceDiscovery(base)) _discoveryOk = false;
+            _publishState = MqttPublishState::DISC_DONE;
             break;
 
-        case MqttPublishState::DISC_CARTRIDGE:
-            #if defined(RC522_ENABLED)
-            publishCartridgeBinarySensorDiscovery();
-            #endif
-            _publishState = MqttPublishState::DISC_DONE;
+        case MqttPublishState::DISC_ENTITY:
+            if (_discEntity == 0 && _discoveryCleanup) {
+                // Drop a device-based config so the entities are not announced twice
+                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/device/rd_%s/config",
+                         MQTT_DISCOVERY_PREFIX, _deviceId.c_str());
+                _mqttClient.publish(_mqttTopic, "", true);
+            }
+            if (!publishEntityDiscovery(_discEntity, base)) _discoveryOk = false;
+            if (++_discEntity >= MQTT_ENTITY_COUNT) {
+                _publishState = MqttPublishState::DISC_DONE;
+            }
             break;
 
         case MqttPublishState::DISC_DONE:
-            Serial.println("[MQTT] Discovery published");
+            if (_discoveryOk) {
+                // Remember what the broker now holds, so reconnects can skip it
+                storage.setDiscoveryHash(_discoveryHash);
+                Serial.println("[MQTT] Discovery published");
+            } else {
+                Serial.println("[MQTT] Discovery incomplete, retrying on next connect");
+            }
             _discoveryPublished = true;
             // Continue to state publish
-            _publishState = MqttPublishState::STATE_FAN;
-            break;
-
-        // State publish states - use snprintf to avoid String heap allocations
-        case MqttPublishState::STATE_FAN:
-            snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/fan/state", base);
-            _mqttClient.publish(_mqttTopic, fanController.isOn() ? "ON" : "OFF", true);
-            _publishState = MqttPublishState::STATE_SPEED;
+            _publishState = MqttPublishState::IDLE;
+            startStatePublish(true);
             break;
 
-        case MqttPublishState::STATE_SPEED:
+        // State publish - one dirty field per step, lowest bit first
+        case MqttPublishState::STATE_FIELDS:
             {
-                char val[8];
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/fan/speed", base);
-                snprintf(val, sizeof(val), "%d", fanController.getSpeed());
-                _mqttClient.publish(_mqttTopic, val, true);
+                uint8_t field = 0;
+                while (field < MQTT_FIELD_COUNT && !(_dirtyFields & (1 << field))) field++;
+                if (field >= MQTT_FIELD_COUNT) {
+                    _publishState = MqttPublishState::STATE_DONE;
+                    break;
+                }
+
+                // Render again - the value may have moved on since it was marked dirty
+                char val[16];
+                const char* payload = renderStateField(field, val, sizeof(val));
+                if (payload) {
+                    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s%s", base, STATE_FIELD_TOPICS[field]);
+                    if (_mqttClient.publish(_mqttTopic, payload, true)) {
+                        _publishedHash[field] = payloadHash(payload);
+                        _statePublishes++;
+                    } else {
+                        _statePublishFailures++;
+                    }
+                    // On failure the hash stays stale, so the next check retries it
+                }
+                _dirtyFields &= ~(1 << field);
+                if (_dirtyFields == 0) {
+                    _publishState = MqttPublishState::STATE_DONE;
+                }
             }
-            _publishState = MqttPublishState::STATE_PRESET;
             break;
 
-        case MqttPublishState::STATE_PRESET:
-            {
-                const char* preset = "Cont";
-                if (fanController.isTimerActive()) {
-                    uint16_t remaining = fanController.getRemainingMinutes();
-                    if (remaining <= 30) preset = "30m";
-                    else if (remaining <= 60) preset = "60m";
-                    else if (remaining <= 90) preset = "90m";
-                    else preset = "120m";
+        // JSON state mode - the whole state in one retained message
+        case MqttPublishState::STATE_JSON:
+            if (renderStateJson(_mqttBuf, sizeof(_mqttBuf)) > 0) {
+                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/state", base);
+                if (_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
+                    _publishedJsonHash = payloadHash(_mqttBuf);
+                    _statePublishes++;
+                } else {
+                    _statePublishFailures++;
                 }
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/fan/preset", base);
-                _mqttClient.publish(_mqttTopic, preset, true);
             }
-            _publishState = MqttPublishState::STATE_INTERVAL;
+            _publishState = MqttPublishState::STATE_DONE;
             break;
 
-        case MqttPublishState::STATE_INTERVAL:
-            snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/interval/state", base);
-            _mqttClient.publish(_mqttTopic, fanController.isIntervalMode() ? "ON" : "OFF", true);
-            _publishState = MqttPublishState::STATE_INTERVAL_TIMES;
+        case MqttPublishState::STATE_DONE:
+            _publishState = MqttPublishState::IDLE;
             break;
 
-        case MqttPublishState::STATE_INTERVAL_TIMES:
-            {
-                char val[8];
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/interval_on/state", base);
-                snprintf(val, sizeof(val), "%d", fanController.getIntervalOnTime());
-                _mqttClient.publish(_mqttTopic, val, true);
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/interval_off/state", base);
-                snprintf(val, sizeof(val), "%d", fanController.getIntervalOffTime());
-                _mqttClient.publish(_mqttTopic, val, true);
-            }
-            _publishState = MqttPublishState::STATE_REMAINING;
+        default:
+            _publishState = MqttPublishState::IDLE;
             break;
+    }
+}
 
-        case MqttPublishState::STATE_REMAINING:
-            {
-                char val[8];
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/remaining_time", base);
-                snprintf(val, sizeof(val), "%u", fanController.getRemainingMinutes());
-                _mqttClient.publish(_mqttTopic, val, true);
-            }
-            _publishState = MqttPublishState::STATE_RPM_WIFI;
-            break;
+void MQTTHandler::startStatePublish(bool full) {
+    if (full) _forceFullRefresh = true;
 
-        case MqttPublishState::STATE_RPM_WIFI:
-            {
-                char val[8];
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/rpm", base);
-                snprintf(val, sizeof(val), "%u", fanController.getRPM());
-                _mqttClient.publish(_mqttTopic, val, true);
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/wifi_signal", base);
-                snprintf(val, sizeof(val), "%d", wifiManager.getRSSI());
-                _mqttClient.publish(_mqttTopic, val, true);
-            }
-            _publishState = MqttPublishState::STATE_RUNTIME;
-            break;
+    if (_jsonState) {
+        // Only called while the publish buffers are free (IDLE / DISC_DONE)
+        if (renderStateJson(_mqttBuf, sizeof(_mqttBuf)) == 0) return;
+        bool changed = _forceFullRefresh || payloadHash(_mqttBuf) != _publishedJsonHash;
+        _forceFullRefresh = false;
+        if (changed && _publishState == MqttPublishState::IDLE) {
+            _publishState = MqttPublishState::STATE_JSON;
+            _lastPublishStep = millis();
+        }
+        return;
+    }
 
-        case MqttPublishState::STATE_RUNTIME:
-            {
-                float totalHours = fanController.getTotalRuntimeMinutes() / 60.0;
-                char val[10];
-                snprintf(val, sizeof(val), "%.1f", totalHours);
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/total_runtime", base);
-                _mqttClient.publish(_mqttTopic, val, true);
+    // Compare every field against what the broker last received from us
+    char val[16];
+    for (uint8_t i = 0; i < MQTT_FIELD_COUNT; i++) {
+        const char* payload = renderStateField(i, val, sizeof(val));
+        if (!payload) continue;
+        if (_forceFullRefresh || payloadHash(payload) != _publishedHash[i]) {
+            _dirtyFields |= (1 << i);
+        }
+    }
+    _forceFullRefresh = false;
+
+    if (_dirtyFields != 0 && _publishState == MqttPublishState::IDLE) {
+        _publishState = MqttPublishState::STATE_FIELDS;
+        _lastPublishStep = millis();
+    }
+}
+
+// Render the current payload of a state field.
+// Returns nullptr when the field has nothing to publish (e.g. no RFID reader).
+// Uses snprintf into the caller's buffer to avoid String heap allocations.
+const char* MQTTHandler::renderStateField(uint8_t field, char* buf, size_t len) {
+    switch (field) {
+        case MQTT_FIELD_FAN:
+            return fanController.isOn() ? "ON" : "OFF";
+
+        case MQTT_FIELD_SPEED:
+            snprintf(buf, len, "%d", fanController.getSpeed());
+            return buf;
+
+        case MQTT_FIELD_PRESET:
+            if (fanController.isTimerActive()) {
+                uint16_t remaining = fanController.getRemainingMinutes();
+                if (remaining <= 30) return "30m";
+                if (remaining <= 60) return "60m";
+                if (remaining <= 90) return "90m";
+                return "120m";
             }
-            _publishState = MqttPublishState::STATE_UPDATE;
-            break;
+            return "Cont";
+
+        case MQTT_FIELD_INTERVAL:
+            return fanController.isIntervalMode() ? "ON" : "OFF";
 
-        case MqttPublishState::STATE_UPDATE:
-            snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/update_available", base);
-            _mqttClient.publish(_mqttTopic, updateChecker.isUpdateAvailable() ? "ON" : "OFF", true);
-            // Only publish latest_version if we have a valid value (not empty)
+        case MQTT_FIELD_INTERVAL_ON:
+            snprintf(buf, len, "%d", fanController.getIntervalOnTime());
+            return buf;
+
+        case MQTT_FIELD_INTERVAL_OFF:
+            snprintf(buf, len, "%d", fanController.getIntervalOffTime());
+            return buf;
+
+        case MQTT_FIELD_REMAINING:
+            snprintf(buf, len, "%u", fanController.getRemainingMinutes());
+            return buf;
+
+        case MQTT_FIELD_RPM:
+            snprintf(buf, len, "%u", fanController.getRPM());
+            return buf;
+
+        case MQTT_FIELD_WIFI:
+            snprintf(buf, len, "%d", wifiManager.getRSSI());
+            return buf;
+
+        case MQTT_FIELD_RUNTIME:
+            snprintf(buf, len, "%.1f", fanController.getTotalRuntimeMinutes() / 60.0);
+            return buf;
+
+        case MQTT_FIELD_UPDATE:
+            return updateChecker.isUpdateAvailable() ? "ON" : "OFF";
+
+        case MQTT_FIELD_LATEST_VERSION:
             {
+                // Only publish latest_version if we have a valid value (not empty)
                 const char* latestVer = updateChecker.getLatestVersion();
-                if (latestVer && latestVer[0] != '\0') {
-                    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/latest_version", base);
-                    _mqttClient.publish(_mqttTopic, latestVer, true);
-                }
+                return (latestVer && latestVer[0] != '\0') ? latestVer : nullptr;
             }
-            snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/current_version", base);
-            _mqttClient.publish(_mqttTopic, updateChecker.getCurrentVersion(), true);
-            _publishState = MqttPublishState::STATE_SCENT;
-            break;
 
-        case MqttPublishState::STATE_SCENT:
-            #if defined(RC522_ENABLED)
-            {
-                // Publish scent name. Avoid String alloc by using the cstr getter -
-                // this state runs every 30s plus on every requestStatePublish(),
-                // so the heap churn was visible on ESP8266.
-                bool hasCartridge = rfidIsCartridgePresent();
-                const char* scent = hasCartridge ? rfidGetLastScentCStr() : "No cartridge";
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/scent", base);
-                _mqttClient.publish(_mqttTopic, scent, true);
-                snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/cartridge_present", base);
-                _mqttClient.publish(_mqttTopic, hasCartridge ? "ON" : "OFF", true);
-            }
-            #endif
-            _publishState = MqttPublishState::STATE_DONE;
-            break;
+        case MQTT_FIELD_CURRENT_VERSION:
+            return updateChecker.getCurrentVersion();
 
-        case MqttPublishState::STATE_DONE:
-            _publishState = MqttPublishState::IDLE;
-            break;
+        #if defined(RC522_ENABLED)
+        case MQTT_FIELD_SCENT:
+            // cstr getter avoids a String alloc on every check
+            return rfidIsCartridgePresent() ? rfidGetLastScentCStr() : "No cartridge";
+
+        case MQTT_FIELD_CARTRIDGE:
+            return rfidIsCartridgePresent() ? "ON" : "OFF";
+        #endif
 
         default:
-            _publishState = MqttPublishState::IDLE;
-            break;
+            return nullptr;
     }
+}
 
-    // Give system time after each publish
-    _mqttClient.loop();
+// Serialise every state field into one compact JSON object, e.g.
+// {"fan":"ON","speed":50,"preset":"Cont",...}. Fields without a value are omitted.
+// Returns the payload length, or 0 if it did not fit.
+size_t MQTTHandler::renderStateJson(char* buf, size_t len) {
+    size_t pos = 0;
+    char val[16];
+    buf[pos++] = '{';
+    for (uint8_t i = 0; i < MQTT_FIELD_COUNT; i++) {
+        const char* payload = renderStateField(i, val, sizeof(val));
+        if (!payload) continue;
+
+        int n = snprintf(buf + pos, len - pos, "%s\"%s\":", pos > 1 ? "," : "", STATE_JSON_KEYS[i].key);
+        if (n < 0 || (size_t)n >= len - pos) return 0;
+        pos += n;
+
+        if (STATE_JSON_KEYS[i].numeric) {
+            n = snprintf(buf + pos, len - pos, "%s", payload);
+            if (n < 0 || (size_t)n >= len - pos) return 0;
+            pos += n;
+        } else {
+            // Quote and escape (scent names come from RFID tags)
+            if (pos + 1 >= len) return 0;
+            buf[pos++] = '"';
+            for (const char* s = payload; *s; s++) {
+                if ((uint8_t)*s < 0x20) continue;
+                if (*s == '"' || *s == '\\') {
+                    if (pos + 1 >= len) return 0;
+                    buf[pos++] = '\\';
+                }
+                if (pos + 1 >= len) return 0;
+                buf[pos++] = *s;
+            }
+            if (pos + 1 >= len) return 0;
+            buf[pos++] = '"';
+        }
+    }
+    if (pos + 2 > len) return 0;
+    buf[pos++] = '}';
+    buf[pos] = '\0';
+    return pos;
 }
 
 void MQTTHandler::connect(const char* host, uint16_t port, const char* user, const char* password) {
@@ -369,7 +787,17 @@ void MQTTHandler::connect(const char* host, uint16_t port, const char* user, con
 
     _mqttClient.setServer(host, port);
     _discoveryPublished = false;
-    _lastReconnect = 0; // Force immediate connection attempt
+    // Discovery configs depend on the state mode and format, so they only
+    // change with a reconnect
+    _jsonState = storage.getSettings().mqttJsonState;
+    _deviceDiscovery = storage.getSettings().mqttDeviceDiscovery;
+
+    // Force immediate connection attempt with fresh DNS and no backoff
+    if (_connState != MqttConnState::WAIT) _wifiClient.stop();
+    _connState = MqttConnState::WAIT;
+    _brokerIpValid = false;
+    _backoff = 0;
+    _reconnectDelay = 0;
 
     Serial.printf("[MQTT] Configured: %s:%d\n", host, port);
 }
@@ -403,70 +831,101 @@ void MQTTHandler::mqttCallback(char* topic, byte* payload, unsigned int length)
 }
 
 void MQTTHandler::handleMessage(const char* topic, const char* payload) {
-    String t = topic;
-    String p = payload;
-
-    if (t.endsWith("/fan/set")) {
-        // ON/OFF command
-        if (p == "ON") {
-            fanController.turnOn();
-        } else if (p == "OFF") {
-            fanController.turnOff();
+    // Home Assistant restarted - it may have lost the retained configs
+    if (strcmp(topic, MQTT_DISCOVERY_PREFIX "/status") == 0) {
+        // HA usually retains its birth message, so the broker replays it right
+        // after every subscribe. PubSubClient drops the retain flag - treat an
+        // "online" that arrives this early as the replay, not a restart.
+        if (millis() - _subscribedAt < MQTT_HA_BIRTH_RETAINED_MS) return;
+        if (strcmp(payload, "online") == 0) {
+            Serial.printf("[MQTT] Home Assistant online, republishing in %lu ms\n", _birthJitter);
+            _birthPending = true;
+            _birthTime = millis();
         }
-    } else if (t.endsWith("/fan/speed/set")) {
-        // Speed percentage - validate input is actually numeric
-        int speed = p.toInt();
-        // toInt() returns 0 for non-numeric strings, only accept if payload was "0" or valid number
-        bool isValidNumber = (speed > 0) || (p == "0");
-        if (isValidNumber) {
-            fanController.setSpeed(speed);
-            storage.setFanSpeed(speed);
-            if (speed > 0 && !fanController.isOn()) {
+        return;
+    }
+
+    // Match the command suffix after our base topic: one memcmp per table entry
+    size_t baseLen = strlen(_baseTopic);
+    if (strncmp(topic, _baseTopic, baseLen) != 0) return;
+    const char* suffix = topic + baseLen;
+    size_t suffixLen = strlen(suffix);
+
+    uint8_t cmd = 0;
+    while (cmd < MQTT_CMD_COUNT &&
+           !(COMMAND_TOPICS[cmd].len == suffixLen && memcmp(COMMAND_TOPICS[cmd].suffix, suffix, suffixLen) == 0)) {
+        cmd++;
+    }
+
+    long value = 0;
+    switch (cmd) {
+        case MQTT_CMD_FAN:
+            // ON/OFF command
+            if (strcmp(payload, "ON") == 0) {
                 fanController.turnOn();
+            } else if (strcmp(payload, "OFF") == 0) {
+                fanController.turnOff();
             }
-        } else {
-            Serial.printf("[MQTT] Invalid speed value: %s\n", p.c_str());
-        }
-    } else if (t.endsWith("/fan/preset/set")) {
-        // Timer preset (short names to save MQTT buffer space)
-        if (p == "30m") {
-            fanController.setTimer(30);
-        } else if (p == "60m") {
-            fanController.setTimer(60);
-        } else if (p == "90m") {
-            fanController.setTimer(90);
-        } else if (p == "120m") {
-            fanController.setTimer(120);
-        } else if (p == "Cont") {
-            fanController.cancelTimer();
-            if (!fanController.isOn()) fanController.turnOn();
-        }
-        updateLedStatus();
-    } else if (t.endsWith("/interval/set")) {
-        // Interval mode switch
-        bool interval = (p == "ON");
-        fanController.setIntervalMode(interval);
-        storage.setIntervalMode(interval, fanController.getIntervalOnTime(), fanController.getIntervalOffTime());
-        updateLedStatus();
-    } else if (t.endsWith("/interval_on/set")) {
-        // Interval on time - validate input
-        int newOnTime = p.toInt();
-        if (newOnTime > 0) {
-            fanController.setIntervalTimes(newOnTime, fanController.getIntervalOffTime());
-            // Persist clamped values (raw int would silently wrap when cast to uint8_t)
-            storage.setIntervalMode(fanController.isIntervalMode(),
-                                    fanController.getIntervalOnTime(),
-                                    fanController.getIntervalOffTime());
-        }
-    } else if (t.endsWith("/interval_off/set")) {
-        // Interval off time - validate input
-        int newOffTime = p.toInt();
-        if (newOffTime > 0) {
-            fanController.setIntervalTimes(fanController.getIntervalOnTime(), newOffTime);
-            storage.setIntervalMode(fanController.isIntervalMode(),
-                                    fanController.getIntervalOnTime(),
-                                    fanController.getIntervalOffTime());
-        }
+            break;
+
+        case MQTT_CMD_SPEED:
+            // Speed percentage - reject anything that isn't a number in range
+            if (parseBoundedInt(payload, 100, value)) {
+                fanController.setSpeed(value);
+                storage.setFanSpeed(value);
+                if (value > 0 && !fanController.isOn()) {
+                    fanController.turnOn();
+                }
+            } else {
+                Serial.printf("[MQTT] Invalid speed value: %s\n", payload);
+            }
+            break;
+
+        case MQTT_CMD_PRESET:
+            // Timer preset (short names to save MQTT buffer space)
+            if (strcmp(payload, "30m") == 0) {
+                fanController.setTimer(30);
+            } else if (strcmp(payload, "60m") == 0) {
+                fanController.setTimer(60);
+            } else if (strcmp(payload, "90m") == 0) {
+                fanController.setTimer(90);
+            } else if (strcmp(payload, "120m") == 0) {
+                fanController.setTimer(120);
+            } else if (strcmp(payload, "Cont") == 0) {
+                fanController.cancelTimer();
+                if (!fanController.isOn()) fanController.turnOn();
+            }
+            updateLedStatus();
+            break;
+
+        case MQTT_CMD_INTERVAL:
+            {
+                // Interval mode switch
+                bool interval = (strcmp(payload, "ON") == 0);
+                fanController.setIntervalMode(interval);
+                storage.setIntervalMode(interval, fanController.getIntervalOnTime(), fanController.getIntervalOffTime());
+                updateLedStatus();
+            }
+            break;
+
+        case MQTT_CMD_INTERVAL_ON:
+        case MQTT_CMD_INTERVAL_OFF:
+            // Interval on/off time - clamp before narrowing to the uint8_t setter
+            if (parseBoundedInt(payload, 65535, value) && value > 0) {
+                uint8_t seconds = constrain(value, INTERVAL_MIN, INTERVAL_MAX);
+                if (cmd == MQTT_CMD_INTERVAL_ON) {
+                    fanController.setIntervalTimes(seconds, fanController.getIntervalOffTime());
+                } else {
+                    fanController.setIntervalTimes(fanController.getIntervalOnTime(), seconds);
+                }
+                storage.setIntervalMode(fanController.isIntervalMode(),
+                                        fanController.getIntervalOnTime(),
+                                        fanController.getIntervalOffTime());
+            }
+            break;
+
+        default:
+            return;  // Not one of our command topics
     }
 
     // Request state publish (non-blocking)
@@ -478,361 +937,468 @@ void MQTTHandler::handleMessage(const char* topic, const char* payload) {
     }
 }
 
-void MQTTHandler::onCommand(CommandCallback callback) {
-    _commandCallback = callback;
-}
+void MQTTHandler::queueEvent(MqttEventType type, const char* fields) {
+    if (type >= MQTT_EVENT_COUNT) return;
 
-String MQTTHandler::getBaseTopic() {
-    // Include device ID for unique topics when multiple diffusers are present
-    return String(MQTT_TOPIC_PREFIX) + "_" + _deviceId;
-}
-
-void MQTTHandler::publishDiscovery() {
-    // Start the discovery state machine (non-blocking)
-    if (_publishState == MqttPublishState::IDLE) {
-        _publishState = MqttPublishState::DISC_FAN;
-        _lastPublishStep = millis();
-        Serial.println("[MQTT] Publishing Home Assistant discovery...");
+    // Timestamp now - delivery may be much later. Epoch only once NTP has synced.
+    char payload[MQTT_EVENT_SIZE];
+    size_t n = snprintf(payload, sizeof(payload), "{\"ev\":\"%s\",\"up\":%lu",
+                        EVENT_NAMES[type], millis() / 1000);
+    time_t epoch = time(nullptr);
+    if (epoch > 1000000000 && n < sizeof(payload)) {
+        n += snprintf(payload + n, sizeof(payload) - n, ",\"ts\":%ld", (long)epoch);
     }
-}
-
-void MQTTHandler::publishFanDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
-
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/fan/rd_%s/config", MQTT_DISCOVERY_PREFIX, id);
-
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Diffuser\","
-        "\"uniq_id\":\"rd_%s\","
-        "\"stat_t\":\"%s/fan/state\","
-        "\"cmd_t\":\"%s/fan/set\","
-        "\"pct_stat_t\":\"%s/fan/speed\","
-        "\"pct_cmd_t\":\"%s/fan/speed/set\","
-        "\"pr_mode_stat_t\":\"%s/fan/preset\","
-        "\"pr_mode_cmd_t\":\"%s/fan/preset/set\","
-        "\"pr_modes\":[\"30m\",\"60m\",\"90m\",\"120m\",\"Cont\"],"
-        "\"avty_t\":\"%s/availability\","
-        "\"spd_rng_min\":1,\"spd_rng_max\":100,"
-        "\"dev\":{\"ids\":[\"rituals_%s\"],"
-        "\"name\":\"Rituals Diffuser\",\"mf\":\"Rituals\",\"mdl\":\"Genie 2.0\"}}",
-        id, base, base, base, base, base, base, base, id);
-
-    Serial.printf("[MQTT] Fan discovery: %d bytes\n", (int)strlen(_mqttBuf));
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Fan discovery publish FAILED - buffer too small?");
+    if (fields && fields[0] && n < sizeof(payload)) {
+        n += snprintf(payload + n, sizeof(payload) - n, ",%s", fields);
+    }
+    if (n + 1 >= sizeof(payload)) {
+        Serial.printf("[MQTT] Event %s too large, dropped\n", EVENT_NAMES[type]);
+        return;
+    }
+    payload[n++] = '}';
+    payload[n] = '\0';
+
+    lockOutbox();
+    // A newer fan state supersedes a queued one: drop that, keep the others
+    // in order. Entries already written stay until they are confirmed.
+    if (type == MQTT_EVENT_FAN) {
+        for (uint8_t i = _outboxSent; i < _outboxCount; i++) {
+            uint8_t idx = (_outboxHead + i) % MQTT_OUTBOX_SIZE;
+            if (_outbox[idx].type != MQTT_EVENT_FAN) continue;
+            for (uint8_t j = i + 1; j < _outboxCount; j++) {
+                _outbox[(_outboxHead + j - 1) % MQTT_OUTBOX_SIZE] = _outbox[(_outboxHead + j) % MQTT_OUTBOX_SIZE];
+            }
+            _outboxCount--;
+            _eventsCoalesced++;
+            break;
+        }
     }
+    // Full: the oldest event is lost rather than the newest
+    if (_outboxCount >= MQTT_OUTBOX_SIZE) {
+        if (!_outbox[_outboxHead].sent) _eventsDropped++;
+        if (_outboxSent > 0) _outboxSent--;
+        _outboxHead = (_outboxHead + 1) % MQTT_OUTBOX_SIZE;
+        _outboxCount--;
+    }
+    MqttOutboxEntry& entry = _outbox[(_outboxHead + _outboxCount) % MQTT_OUTBOX_SIZE];
+    entry.seq = ++_outboxSeq;
+    entry.type = type;
+    entry.sent = false;
+    memcpy(entry.payload, payload, n + 1);
+    _outboxCount++;
+    unlockOutbox();
 }
 
-void MQTTHandler::publishIntervalSwitchDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
-
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/switch/rd_%s_int/config", MQTT_DISCOVERY_PREFIX, id);
+bool MQTTHandler::publishTelemetry(const char* payload, size_t length) {
+    if (!_mqttClient.connected()) return false;
+    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/telemetry", _baseTopic);
+    return _mqttClient.publish(_mqttTopic, (const uint8_t*)payload, length, false);
+}
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Interval Mode\","
-        "\"uniq_id\":\"rd_%s_int\","
-        "\"stat_t\":\"%s/interval/state\","
-        "\"cmd_t\":\"%s/interval/set\","
-        "\"avty_t\":\"%s/availability\","
-        "\"ic\":\"mdi:timer-sand\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, base, id);
+// Publish the oldest event not yet written. PubSubClient only publishes
+// QoS 0, so a successful write is not delivery: the entry stays in the
+// outbox, marked sent, until confirmOutbox() sees the connection outlive a
+// keepalive round trip. A failed write is retried on the next step.
+void MQTTHandler::flushOutbox() {
+    char payload[MQTT_EVENT_SIZE];
+    uint16_t seq;
+    bool replay;
+
+    lockOutbox();
+    if (_outboxSent >= _outboxCount) {
+        unlockOutbox();
+        return;
+    }
+    const MqttOutboxEntry& entry = _outbox[(_outboxHead + _outboxSent) % MQTT_OUTBOX_SIZE];
+    seq = entry.seq;
+    replay = entry.sent;
+    memcpy(payload, entry.payload, sizeof(payload));
+    unlockOutbox();
+
+    // {"seq":N, followed by the stored payload without its opening brace
+    char message[MQTT_EVENT_SIZE + 16];
+    snprintf(message, sizeof(message), "{\"seq\":%u,%s", seq, payload + 1);
+    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/event", _baseTopic);
+    if (!_mqttClient.publish(_mqttTopic, message, false)) return;
+    if (replay) {
+        _eventsReplayed++;
+    } else {
+        _eventsSent++;
+    }
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Interval switch discovery publish FAILED");
+    // Mark it sent unless a concurrent queueEvent() coalesced or dropped it.
+    // A drop of an older sent entry moves the head and _outboxSent together,
+    // so the index still points at the same entry.
+    lockOutbox();
+    if (_outboxSent < _outboxCount) {
+        MqttOutboxEntry& sent = _outbox[(_outboxHead + _outboxSent) % MQTT_OUTBOX_SIZE];
+        if (sent.seq == seq) {
+            sent.sent = true;
+            sent.sentAt = millis();
+            _outboxSent++;
+        }
     }
+    unlockOutbox();
 }
 
-void MQTTHandler::publishIntervalOnTimeDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
+// Release written events once the connection has outlived a keepalive round
+// trip after them (MQTT_EVENT_CONFIRM_MS). Until then a reconnect replays them.
+void MQTTHandler::confirmOutbox() {
+    if (_outboxSent == 0 || !_mqttClient.connected()) return;
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/number/rd_%s_ion/config", MQTT_DISCOVERY_PREFIX, id);
-
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Interval On\","
-        "\"uniq_id\":\"rd_%s_ion\","
-        "\"stat_t\":\"%s/interval_on/state\","
-        "\"cmd_t\":\"%s/interval_on/set\","
-        "\"avty_t\":\"%s/availability\","
-        "\"min\":10,\"max\":120,\"step\":5,"
-        "\"unit_of_meas\":\"s\",\"ic\":\"mdi:timer\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, base, id);
-
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Interval on time discovery publish FAILED");
+    unsigned long now = millis();
+    lockOutbox();
+    while (_outboxSent > 0 && now - _outbox[_outboxHead].sentAt >= MQTT_EVENT_CONFIRM_MS) {
+        _outboxHead = (_outboxHead + 1) % MQTT_OUTBOX_SIZE;
+        _outboxCount--;
+        _outboxSent--;
     }
+    unlockOutbox();
 }
 
-void MQTTHandler::publishIntervalOffTimeDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
-
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/number/rd_%s_ioff/config", MQTT_DISCOVERY_PREFIX, id);
-
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Interval Off\","
-        "\"uniq_id\":\"rd_%s_ioff\","
-        "\"stat_t\":\"%s/interval_off/state\","
-        "\"cmd_t\":\"%s/interval_off/set\","
-        "\"avty_t\":\"%s/availability\","
-        "\"min\":10,\"max\":120,\"step\":5,"
-        "\"unit_of_meas\":\"s\",\"ic\":\"mdi:timer-off\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, base, id);
+void MQTTHandler::onCommand(CommandCallback callback) {
+    _commandCallback = callback;
+}
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Interval off time discovery publish FAILED");
+void MQTTHandler::publishDiscovery() {
+    // Start the discovery state machine (non-blocking)
+    if (_publishState == MqttPublishState::IDLE) {
+        startDiscovery();
+        Serial.println("[MQTT] Publishing Home Assistant discovery...");
     }
 }
 
-void MQTTHandler::publishRemainingTimeSensorDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
+void MQTTHandler::startDiscovery() {
+    _discEntity = 0;
+    _discoveryOk = true;
+    _discoveryHash = discoveryHash();
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/sensor/rd_%s_rem/config", MQTT_DISCOVERY_PREFIX, id);
+    // Configs in the other format only need clearing once, when the format
+    // changed or the broker's contents are unknown (no stored hash)
+    uint32_t stored = storage.getSettings().discoveryHash;
+    _discoveryCleanup = stored == 0 || (stored & 1) != _deviceDiscovery;
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Time Left\","
-        "\"uniq_id\":\"rd_%s_rem\","
-        "\"stat_t\":\"%s/remaining_time\","
-        "\"avty_t\":\"%s/availability\","
-        "\"unit_of_meas\":\"min\",\"ic\":\"mdi:clock-outline\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
-
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Remaining time sensor discovery publish FAILED");
-    }
+    _publishState = _deviceDiscovery ? MqttPublishState::DISC_DEVICE : MqttPublishState::DISC_ENTITY;
+    _lastPublishStep = millis();
 }
 
-void MQTTHandler::publishRPMSensorDiscovery() {
-    const char* id = _deviceId.c_str();
+// Fingerprint of everything the retained discovery configs depend on: broker,
+// format, firmware version and the rendered entity configs (which cover the
+// device ID, JSON state mode and RFID entities). Never 0, which means "none".
+// The lowest bit is the format, so the stored hash also records which format
+// the broker holds.
+// Uses _mqttBuf, so only call while no publish is in progress.
+uint32_t MQTTHandler::discoveryHash() {
     char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
-
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/sensor/rd_%s_rpm/config", MQTT_DISCOVERY_PREFIX, id);
-
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Fan RPM\","
-        "\"uniq_id\":\"rd_%s_rpm\","
-        "\"stat_t\":\"%s/rpm\","
-        "\"avty_t\":\"%s/availability\","
-        "\"unit_of_meas\":\"RPM\",\"ic\":\"mdi:fan\","
-        "\"ent_cat\":\"diagnostic\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
+    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, _deviceId.c_str());
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] RPM sensor discovery publish FAILED");
+    snprintf(_mqttBuf, sizeof(_mqttBuf), "%s:%u|%d|%s",
+             _host.c_str(), _port, _deviceDiscovery, FIRMWARE_VERSION);
+    uint32_t hash = payloadHash(_mqttBuf);
+    for (uint8_t i = 0; i < MQTT_ENTITY_COUNT; i++) {
+        if (renderDiscoveryBody(i, _mqttBuf, sizeof(_mqttBuf), base) > 0) {
+            hash = payloadHash(_mqttBuf, hash);
+        }
     }
+    hash = (hash & ~1UL) | (_deviceDiscovery ? 1 : 0);
+    return hash ? hash : 2;
 }
 
-void MQTTHandler::publishWiFiSensorDiscovery() {
+// Render the entity-specific part of a discovery config, without braces,
+// availability or device block (those differ between per-entity and
+// device-based discovery). Returns the length, or 0 when the entity is not
+// present in this build (e.g. no RFID reader).
+size_t MQTTHandler::renderDiscoveryBody(uint8_t entity, char* buf, size_t len, const char* base) {
     const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
+    char st[128];
+    int n = 0;
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/sensor/rd_%s_wifi/config", MQTT_DISCOVERY_PREFIX, id);
+    switch (entity) {
+        case MQTT_ENTITY_FAN:
+            {
+                // In JSON state mode the fan also exposes the full state as attributes
+                char pct[128], pre[128], attr[64];
+                formatStateTopic(st, sizeof(st), base, MQTT_FIELD_FAN, _jsonState, "stat_t", "stat_val_tpl");
+                formatStateTopic(pct, sizeof(pct), base, MQTT_FIELD_SPEED, _jsonState, "pct_stat_t", "pct_val_tpl");
+                formatStateTopic(pre, sizeof(pre), base, MQTT_FIELD_PRESET, _jsonState, "pr_mode_stat_t", "pr_mode_val_tpl");
+                if (_jsonState) {
+                    snprintf(attr, sizeof(attr), "\"json_attr_t\":\"%s/state\",", base);
+                } else {
+                    attr[0] = '\0';
+                }
+                n = snprintf(buf, len,
+                    "\"name\":\"Diffuser\","
+                    "\"uniq_id\":\"rd_%s\","
+                    "%s,"
+                    "\"cmd_t\":\"%s/fan/set\","
+                    "%s,"
+                    "\"pct_cmd_t\":\"%s/fan/speed/set\","
+                    "%s,"
+                    "\"pr_mode_cmd_t\":\"%s/fan/preset/set\","
+                    "\"pr_modes\":[\"30m\",\"60m\",\"90m\",\"120m\",\"Cont\"],"
+                    "%s"
+                    "\"spd_rng_min\":1,\"spd_rng_max\":100",
+                    id, st, base, pct, base, pre, base, attr);
+            }
+            break;
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"WiFi Signal\","
-        "\"uniq_id\":\"rd_%s_wifi\","
-        "\"stat_t\":\"%s/wifi_signal\","
-        "\"avty_t\":\"%s/availability\","
-        "\"unit_of_meas\":\"dBm\",\"dev_cla\":\"signal_strength\","
-        "\"ent_cat\":\"diagnostic\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
+        case MQTT_ENTITY_INTERVAL_SWITCH:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_INTERVAL, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Interval Mode\","
+                "\"uniq_id\":\"rd_%s_int\","
+                "%s,"
+                "\"cmd_t\":\"%s/interval/set\","
+                "\"ic\":\"mdi:timer-sand\"",
+                id, st, base);
+            break;
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] WiFi sensor discovery publish FAILED");
-    }
-}
+        case MQTT_ENTITY_INTERVAL_ON:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_INTERVAL_ON, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Interval On\","
+                "\"uniq_id\":\"rd_%s_ion\","
+                "%s,"
+                "\"cmd_t\":\"%s/interval_on/set\","
+                "\"min\":10,\"max\":120,\"step\":5,"
+                "\"unit_of_meas\":\"s\",\"ic\":\"mdi:timer\"",
+                id, st, base);
+            break;
 
-void MQTTHandler::publishTotalRuntimeSensorDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
+        case MQTT_ENTITY_INTERVAL_OFF:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_INTERVAL_OFF, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Interval Off\","
+                "\"uniq_id\":\"rd_%s_ioff\","
+                "%s,"
+                "\"cmd_t\":\"%s/interval_off/set\","
+                "\"min\":10,\"max\":120,\"step\":5,"
+                "\"unit_of_meas\":\"s\",\"ic\":\"mdi:timer-off\"",
+                id, st, base);
+            break;
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/sensor/rd_%s_trun/config", MQTT_DISCOVERY_PREFIX, id);
+        case MQTT_ENTITY_REMAINING:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_REMAINING, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Time Left\","
+                "\"uniq_id\":\"rd_%s_rem\","
+                "%s,"
+                "\"unit_of_meas\":\"min\",\"ic\":\"mdi:clock-outline\"",
+                id, st);
+            break;
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Total Runtime\","
-        "\"uniq_id\":\"rd_%s_trun\","
-        "\"stat_t\":\"%s/total_runtime\","
-        "\"avty_t\":\"%s/availability\","
-        "\"unit_of_meas\":\"h\",\"ic\":\"mdi:clock-check\","
-        "\"ent_cat\":\"diagnostic\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
+        case MQTT_ENTITY_RPM:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_RPM, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Fan RPM\","
+                "\"uniq_id\":\"rd_%s_rpm\","
+                "%s,"
+                "\"unit_of_meas\":\"RPM\",\"ic\":\"mdi:fan\","
+                "\"ent_cat\":\"diagnostic\"",
+                id, st);
+            break;
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Total runtime sensor discovery publish FAILED");
-    }
-}
+        case MQTT_ENTITY_WIFI:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_WIFI, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"WiFi Signal\","
+                "\"uniq_id\":\"rd_%s_wifi\","
+                "%s,"
+                "\"unit_of_meas\":\"dBm\",\"dev_cla\":\"signal_strength\","
+                "\"ent_cat\":\"diagnostic\"",
+                id, st);
+            break;
 
-void MQTTHandler::publishUpdateAvailableBinarySensorDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
+        case MQTT_ENTITY_RUNTIME:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_RUNTIME, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Total Runtime\","
+                "\"uniq_id\":\"rd_%s_trun\","
+                "%s,"
+                "\"unit_of_meas\":\"h\",\"ic\":\"mdi:clock-check\","
+                "\"ent_cat\":\"diagnostic\"",
+                id, st);
+            break;
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/binary_sensor/rd_%s_upd/config", MQTT_DISCOVERY_PREFIX, id);
+        case MQTT_ENTITY_UPDATE:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_UPDATE, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Update Available\","
+                "\"uniq_id\":\"rd_%s_upd\","
+                "%s,"
+                "\"dev_cla\":\"update\","
+                "\"ent_cat\":\"diagnostic\"",
+                id, st);
+            break;
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Update Available\","
-        "\"uniq_id\":\"rd_%s_upd\","
-        "\"stat_t\":\"%s/update_available\","
-        "\"avty_t\":\"%s/availability\","
-        "\"dev_cla\":\"update\","
-        "\"ent_cat\":\"diagnostic\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
+        case MQTT_ENTITY_LATEST_VERSION:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_LATEST_VERSION, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Latest Version\","
+                "\"uniq_id\":\"rd_%s_latver\","
+                "%s,"
+                "\"ic\":\"mdi:package-up\","
+                "\"ent_cat\":\"diagnostic\"",
+                id, st);
+            break;
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Update available sensor discovery publish FAILED");
-    }
-}
+        case MQTT_ENTITY_CURRENT_VERSION:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_CURRENT_VERSION, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Firmware Version\","
+                "\"uniq_id\":\"rd_%s_curver\","
+                "%s,"
+                "\"ic\":\"mdi:chip\","
+                "\"ent_cat\":\"diagnostic\"",
+                id, st);
+            break;
 
-void MQTTHandler::publishLatestVersionSensorDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
+        #if defined(RC522_ENABLED)
+        case MQTT_ENTITY_SCENT:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_SCENT, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Scent Cartridge\","
+                "\"uniq_id\":\"rd_%s_scent\","
+                "%s,"
+                "\"ic\":\"mdi:spray\"",
+                id, st);
+            break;
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/sensor/rd_%s_latver/config", MQTT_DISCOVERY_PREFIX, id);
+        case MQTT_ENTITY_CARTRIDGE:
+            formatStateTopic(st, sizeof(st), base, MQTT_FIELD_CARTRIDGE, _jsonState, "stat_t", "val_tpl");
+            n = snprintf(buf, len,
+                "\"name\":\"Cartridge Present\","
+                "\"uniq_id\":\"rd_%s_cartridge\","
+                "%s,"
+                "\"dev_cla\":\"presence\","
+                "\"ic\":\"mdi:tag-outline\"",
+                id, st);
+            break;
+        #endif
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Latest Version\","
-        "\"uniq_id\":\"rd_%s_latver\","
-        "\"stat_t\":\"%s/latest_version\","
-        "\"avty_t\":\"%s/availability\","
-        "\"ic\":\"mdi:package-up\","
-        "\"ent_cat\":\"diagnostic\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
+        default:
+            return 0;
+    }
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Latest version sensor discovery publish FAILED");
+    if (n < 0 || (size_t)n >= len) {
+        Serial.printf("[MQTT] Discovery config for entity %d truncated\n", entity);
+        return 0;
     }
+    return n;
 }
 
-void MQTTHandler::publishCurrentVersionSensorDiscovery() {
+// Per-entity discovery (fallback for Home Assistant < 2024.11):
+// one retained config per entity, each carrying availability and device link
+bool MQTTHandler::publishEntityDiscovery(uint8_t entity, const char* base) {
     const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/sensor/rd_%s_curver/config", MQTT_DISCOVERY_PREFIX, id);
+    _mqttBuf[0] = '{';
+    size_t len = renderDiscoveryBody(entity, _mqttBuf + 1, sizeof(_mqttBuf) - 1, base);
+    if (len == 0) return true;  // Not part of this build
+    len++;
+
+    // Only the fan carries the full device block, the rest link to it by ID
+    if (entity == MQTT_ENTITY_FAN) {
+        snprintf(_mqttBuf + len, sizeof(_mqttBuf) - len,
+            ",\"avty_t\":\"%s/availability\","
+            "\"dev\":{\"ids\":[\"rituals_%s\"],"
+            "\"name\":\"Rituals Diffuser\",\"mf\":\"Rituals\",\"mdl\":\"Genie 2.0\"}}",
+            base, id);
+    } else {
+        snprintf(_mqttBuf + len, sizeof(_mqttBuf) - len,
+            ",\"avty_t\":\"%s/availability\","
+            "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
+            base, id);
+    }
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Firmware Version\","
-        "\"uniq_id\":\"rd_%s_curver\","
-        "\"stat_t\":\"%s/current_version\","
-        "\"avty_t\":\"%s/availability\","
-        "\"ic\":\"mdi:chip\","
-        "\"ent_cat\":\"diagnostic\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
+    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/%s/rd_%s%s/config", MQTT_DISCOVERY_PREFIX,
+             DISCOVERY_ENTITIES[entity].component, id, DISCOVERY_ENTITIES[entity].suffix);
 
     if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Current version sensor discovery publish FAILED");
+        Serial.printf("[MQTT] Discovery publish FAILED (%d bytes): %s\n", (int)strlen(_mqttBuf), _mqttTopic);
+        return false;
     }
+    return true;
 }
 
-#if defined(RC522_ENABLED)
-void MQTTHandler::publishScentSensorDiscovery() {
+// Device-based discovery (Home Assistant 2024.11+): the device block once and
+// every entity under "cmps" in a single retained message. Each piece is
+// rendered into _mqttBuf and written straight to the socket, so the ~3 KB
+// payload never has to fit in one buffer. Runs twice: send=false measures the
+// length beginPublish() needs, send=true writes and returns the bytes written.
+size_t MQTTHandler::streamDeviceDiscovery(const char* base, bool send) {
     const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
-
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/sensor/rd_%s_scent/config", MQTT_DISCOVERY_PREFIX, id);
+    size_t total = 0;
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Scent Cartridge\","
-        "\"uniq_id\":\"rd_%s_scent\","
-        "\"stat_t\":\"%s/scent\","
+    int n = snprintf(_mqttBuf, sizeof(_mqttBuf),
+        "{\"dev\":{\"ids\":[\"rituals_%s\"],"
+        "\"name\":\"Rituals Diffuser\",\"mf\":\"Rituals\",\"mdl\":\"Genie 2.0\",\"sw\":\"%s\"},"
+        "\"o\":{\"name\":\"Rituals-diffuser\",\"sw\":\"%s\",\"url\":\"https://github.com/%s\"},"
         "\"avty_t\":\"%s/availability\","
-        "\"ic\":\"mdi:spray\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
-
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Scent sensor discovery publish FAILED");
+        "\"cmps\":{",
+        id, FIRMWARE_VERSION, FIRMWARE_VERSION, UPDATE_GITHUB_REPO, base);
+    total += send ? _mqttClient.write((const uint8_t*)_mqttBuf, n) : n;
+
+    bool first = true;
+    for (uint8_t i = 0; i < MQTT_ENTITY_COUNT; i++) {
+        n = snprintf(_mqttBuf, sizeof(_mqttBuf), "%s\"rd_%s%s\":{\"p\":\"%s\",",
+                     first ? "" : ",", id, DISCOVERY_ENTITIES[i].suffix, DISCOVERY_ENTITIES[i].component);
+        // Leave room for the closing brace
+        size_t body = renderDiscoveryBody(i, _mqttBuf + n, sizeof(_mqttBuf) - n - 1, base);
+        if (body == 0) continue;
+        n += body;
+        _mqttBuf[n++] = '}';
+        total += send ? _mqttClient.write((const uint8_t*)_mqttBuf, n) : n;
+        first = false;
     }
-}
 
-void MQTTHandler::publishCartridgeBinarySensorDiscovery() {
-    const char* id = _deviceId.c_str();
-    char base[48];
-    snprintf(base, sizeof(base), "%s_%s", MQTT_TOPIC_PREFIX, id);
+    total += send ? _mqttClient.write((const uint8_t*)"}}", 2) : 2;
+    return total;
+}
 
-    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/binary_sensor/rd_%s_cartridge/config", MQTT_DISCOVERY_PREFIX, id);
+bool MQTTHandler::publishDeviceDiscovery(const char* base) {
+    size_t length = streamDeviceDiscovery(base, false);
 
-    snprintf(_mqttBuf, sizeof(_mqttBuf),
-        "{\"name\":\"Cartridge Present\","
-        "\"uniq_id\":\"rd_%s_cartridge\","
-        "\"stat_t\":\"%s/cartridge_present\","
-        "\"avty_t\":\"%s/availability\","
-        "\"dev_cla\":\"presence\","
-        "\"ic\":\"mdi:tag-outline\","
-        "\"dev\":{\"ids\":[\"rituals_%s\"]}}",
-        id, base, base, id);
+    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/device/rd_%s/config", MQTT_DISCOVERY_PREFIX, _deviceId.c_str());
+    if (!_mqttClient.beginPublish(_mqttTopic, length, true)) {
+        Serial.println("[MQTT] Device discovery publish FAILED");
+        return false;
+    }
+    size_t written = streamDeviceDiscovery(base, true);
+    _mqttClient.endPublish();
 
-    if (!_mqttClient.publish(_mqttTopic, _mqttBuf, true)) {
-        Serial.println("[MQTT] Cartridge binary sensor discovery publish FAILED");
+    if (written != length) {
+        Serial.printf("[MQTT] Device discovery publish FAILED (%u of %u bytes)\n",
+                      (unsigned)written, (unsigned)length);
+        return false;
     }
+    Serial.printf("[MQTT] Device discovery: %u bytes\n", (unsigned)length);
+    return true;
 }
-#else
-// Empty stubs for non-RFID builds
-void MQTTHandler::publishScentSensorDiscovery() {}
-void MQTTHandler::publishCartridgeBinarySensorDiscovery() {}
-#endif
 
 void MQTTHandler::removeDiscovery() {
     const char* id = _deviceId.c_str();
-    const char* pre = MQTT_DISCOVERY_PREFIX;
-
-    // Remove all discovery configs by publishing empty payload
-    // Must mirror every entity published in processPublishStateMachine() DISC_* states
-    const char* suffixes[] = {
-        "fan/rd_%s/config",
-        "switch/rd_%s_int/config",
-        "number/rd_%s_ion/config",
-        "number/rd_%s_ioff/config",
-        "sensor/rd_%s_rem/config",
-        "sensor/rd_%s_rpm/config",
-        "sensor/rd_%s_wifi/config",
-        "sensor/rd_%s_trun/config",
-        "binary_sensor/rd_%s_upd/config",
-        "sensor/rd_%s_latver/config",
-        "sensor/rd_%s_curver/config",
-        "sensor/rd_%s_scent/config",
-        "binary_sensor/rd_%s_cartridge/config"
-    };
-
-    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
-        char suffix[64];
-        snprintf(suffix, sizeof(suffix), suffixes[i], id);
-        snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/%s", pre, suffix);
+
+    // Remove all discovery configs by publishing empty payload,
+    // for both the device-based and the per-entity format
+    snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/device/rd_%s/config", MQTT_DISCOVERY_PREFIX, id);
+    _mqttClient.publish(_mqttTopic, "", true);
+
+    for (uint8_t i = 0; i < MQTT_ENTITY_COUNT; i++) {
+        snprintf(_mqttTopic, sizeof(_mqttTopic), "%s/%s/rd_%s%s/config", MQTT_DISCOVERY_PREFIX,
+                 DISCOVERY_ENTITIES[i].component, id, DISCOVERY_ENTITIES[i].suffix);
         _mqttClient.publish(_mqttTopic, "", true);
     }
 
     _discoveryPublished = false;
+    storage.setDiscoveryHash(0);
     Serial.println("[MQTT] Discovery removed");
 }
 
 void MQTTHandler::publishState() {
-    // Start the state publish state machine (non-blocking)
+    // Start the state publish state machine (non-blocking), all fields
     if (_publishState == MqttPublishState::IDLE) {
-        _publishState = MqttPublishState::STATE_FAN;
-        _lastPublishStep = millis();
+        startStatePublish(true);
     }
 }
 
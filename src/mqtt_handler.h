@@ -16,34 +16,110 @@
 enum class MqttPublishState {
     IDLE,
     // Discovery states
-    DISC_FAN,
-    DISC_INTERVAL_SWITCH,
-    DISC_INTERVAL_ON,
-    DISC_INTERVAL_OFF,
-    DISC_REMAINING,
-    DISC_RPM,
-    DISC_WIFI,
-    DISC_RUNTIME,
-    DISC_UPDATE_AVAILABLE,
-    DISC_LATEST_VERSION,
-    DISC_CURRENT_VERSION,
-    DISC_SCENT,           // RFID scent sensor
-    DISC_CARTRIDGE,       // RFID cartridge present binary sensor
+    DISC_DEVICE,          // Single device-based config (HA 2024.11+)
+    DISC_ENTITY,          // Per-entity configs, one entity per step (fallback)
     DISC_DONE,
     // State publish states
-    STATE_FAN,
-    STATE_SPEED,
-    STATE_PRESET,
-    STATE_INTERVAL,
-    STATE_INTERVAL_TIMES,
-    STATE_REMAINING,
-    STATE_RPM_WIFI,
-    STATE_RUNTIME,
-    STATE_UPDATE,
-    STATE_SCENT,          // RFID scent state
+    STATE_FIELDS,         // One dirty state field per step until none remain
+    STATE_JSON,           // Whole state as one JSON payload on <base>/state
     STATE_DONE
 };
 
+// Connection phases, one per loop() pass. Only WAIT is free; the others are
+// blocking calls with a time bound (see processConnect())
+enum class MqttConnState {
+    WAIT,                 // Waiting for the (backoff) reconnect delay
+    RESOLVE,              // DNS lookup of the broker
+    TCP,                  // TCP connect with bounded timeout
+    HANDSHAKE             // MQTT CONNECT / CONNACK over the open socket
+};
+
+// Logical state fields, each published to its own retained topic (or as one
+// key of the <base>/state JSON payload in JSON state mode).
+// Only fields whose payload differs from the last published one are sent.
+enum MqttStateField : uint8_t {
+    MQTT_FIELD_FAN,
+    MQTT_FIELD_SPEED,
+    MQTT_FIELD_PRESET,
+    MQTT_FIELD_INTERVAL,
+    MQTT_FIELD_INTERVAL_ON,
+    MQTT_FIELD_INTERVAL_OFF,
+    MQTT_FIELD_REMAINING,
+    MQTT_FIELD_RPM,
+    MQTT_FIELD_WIFI,
+    MQTT_FIELD_RUNTIME,
+    MQTT_FIELD_UPDATE,
+    MQTT_FIELD_LATEST_VERSION,
+    MQTT_FIELD_CURRENT_VERSION,
+    MQTT_FIELD_SCENT,         // RFID scent name
+    MQTT_FIELD_CARTRIDGE,     // RFID cartridge present
+    MQTT_FIELD_COUNT
+};
+
+// Home Assistant entities announced via discovery
+enum MqttEntity : uint8_t {
+    MQTT_ENTITY_FAN,
+    MQTT_ENTITY_INTERVAL_SWITCH,
+    MQTT_ENTITY_INTERVAL_ON,
+    MQTT_ENTITY_INTERVAL_OFF,
+    MQTT_ENTITY_REMAINING,
+    MQTT_ENTITY_RPM,
+    MQTT_ENTITY_WIFI,
+    MQTT_ENTITY_RUNTIME,
+    MQTT_ENTITY_UPDATE,
+    MQTT_ENTITY_LATEST_VERSION,
+    MQTT_ENTITY_CURRENT_VERSION,
+    MQTT_ENTITY_SCENT,        // RFID scent sensor
+    MQTT_ENTITY_CARTRIDGE,    // RFID cartridge present binary sensor
+    MQTT_ENTITY_COUNT
+};
+
+// Event messages on <base>/event (not retained). Unlike state they can't be
+// recovered by a later republish, so they go through an outbox that survives
+// broker outages and is replayed in order once connected. Each carries a
+// "seq" (per boot, wraps at 65535); an event written just before the link
+// died is sent again after reconnecting with the same seq, so consumers
+// should dedupe on it.
+enum MqttEventType : uint8_t {
+    MQTT_EVENT_FAN,           // Fan on/off/speed - a newer one supersedes a queued one
+    MQTT_EVENT_TIMER,         // Timer expired
+    MQTT_EVENT_CARTRIDGE,     // Cartridge inserted/removed
+    MQTT_EVENT_COUNT
+};
+
+// Outbox size - ESP8266 has limited RAM
+#ifdef PLATFORM_ESP8266
+    #define MQTT_OUTBOX_SIZE    8
+#else
+    #define MQTT_OUTBOX_SIZE    32
+#endif
+#define MQTT_EVENT_SIZE         128
+// QoS 0 gives no acknowledgement, and a write into a half-open connection
+// succeeds until the keepalive notices. PubSubClient drops a link whose
+// PINGRESP is missing within two keepalive periods of the last traffic, so
+// an event written longer ago than this on a connection that is still up
+// has been followed by a completed round trip.
+#define MQTT_EVENT_CONFIRM_MS   (2UL * MQTT_KEEPALIVE * 1000 + 5000)
+
+struct MqttOutboxEntry {
+    uint16_t seq;                      // Identifies the entry across a concurrent coalesce
+    MqttEventType type;
+    bool sent;                         // Written at least once (a resend is a replay)
+    unsigned long sentAt;              // millis() of the last write
+    char payload[MQTT_EVENT_SIZE];     // Complete JSON, timestamped when queued
+};
+
+// Command topics subscribed under the base topic
+enum MqttCommand : uint8_t {
+    MQTT_CMD_FAN,             // /fan/set
+    MQTT_CMD_SPEED,           // /fan/speed/set
+    MQTT_CMD_PRESET,          // /fan/preset/set
+    MQTT_CMD_INTERVAL,        // /interval/set
+    MQTT_CMD_INTERVAL_ON,     // /interval_on/set
+    MQTT_CMD_INTERVAL_OFF,    // /interval_off/set
+    MQTT_CMD_COUNT
+};
+
 class MQTTHandler {
 public:
     void begin();
@@ -54,6 +130,13 @@ public:
     void disconnect();
     bool isConnected();
 
+    // Connection statistics (diagnostics)
+    uint32_t getConnectAttempts() const { return _connectAttempts; }
+    uint32_t getConnectFailures() const { return _connectFailures; }
+    unsigned long getLastConnectMs() const { return _lastConnectMs; }
+    unsigned long getConnectBlockedMs() const { return _connectBlockedMs; }
+    unsigned long getReconnectDelay() const { return _reconnectDelay; }
+
     // Home Assistant Discovery (non-blocking, starts state machine)
     void publishDiscovery();
     void removeDiscovery();
@@ -69,6 +152,26 @@ public:
         interrupts();
     }
 
+    // High-resolution telemetry batch on <base>/telemetry (not retained, dropped when offline)
+    bool publishTelemetry(const char* payload, size_t length);
+
+    // Events (safe to call from any context, queued while offline)
+    // fields: optional JSON members without braces, e.g. "\"on\":true"
+    void queueEvent(MqttEventType type, const char* fields = nullptr);
+    uint8_t getOutboxCount() const { return _outboxCount; }
+    uint32_t getEventsSent() const { return _eventsSent; }
+    uint32_t getEventsReplayed() const { return _eventsReplayed; }
+    uint32_t getEventsDropped() const { return _eventsDropped; }
+    uint32_t getEventsCoalesced() const { return _eventsCoalesced; }
+
+    // Publish pacing statistics (diagnostics)
+    uint32_t getPublishStalls() const { return _publishStalls; }
+    unsigned long getPublishDelay() const { return _publishDelay; }
+    unsigned long getLastRunMs() const { return _lastRunMs; }
+    uint16_t getLastRunSteps() const { return _lastRunSteps; }
+    uint32_t getStatePublishes() const { return _statePublishes; }
+    uint32_t getStatePublishFailures() const { return _statePublishFailures; }
+
     // Callbacks
     typedef void (*CommandCallback)(const char* topic, const char* payload);
     void onCommand(CommandCallback callback);
@@ -82,16 +185,70 @@ private:
     String _user;
     String _password;
     String _deviceId;
+    char _baseTopic[48];                             // MQTT_TOPIC_PREFIX "_" <device id>
 
-    unsigned long _lastReconnect = 0;
+    // Connection state machine
+    MqttConnState _connState = MqttConnState::WAIT;
+    IPAddress _brokerIp;
+    bool _brokerIpValid = false;
+    unsigned long _lastReconnect = 0;                // Start of the current/last attempt
+    unsigned long _reconnectDelay = 0;               // Wait before the next attempt
+    unsigned long _backoff = 0;                      // Current backoff step (0 = none)
+    uint32_t _connectAttempts = 0;
+    uint32_t _connectFailures = 0;
+    unsigned long _lastConnectMs = 0;                // Attempt start to CONNACK
+    unsigned long _connectBlockedMs = 0;             // Total time spent inside blocking connect calls
     unsigned long _lastStatePublish = 0;
+    unsigned long _lastFullRefresh = 0;
     unsigned long _lastPublishStep = 0;
-    bool _discoveryPublished = false;
+    bool _wasConnected = false;                      // Last connection state seen by loop()
+    bool _discoveryPublished = false;                // Published or verified unchanged this session
+    bool _birthPending = false;                      // HA came online, republish after jitter
+    unsigned long _birthTime = 0;                    // When the HA birth message arrived
+    unsigned long _birthJitter = 0;                  // Per-device delay, spreads fleet load
+    unsigned long _subscribedAt = 0;                 // Subscribed to homeassistant/status
+    bool _discoveryOk = true;                        // Every config of the current run was accepted
+    uint32_t _discoveryHash = 0;                     // Fingerprint of the configs being published
+    bool _discoveryCleanup = false;                  // Clear the other format's configs in this run
     volatile bool _statePublishPending = false;  // Flag for pending state publish request
 
     // Non-blocking state machine
     MqttPublishState _publishState = MqttPublishState::IDLE;
-    static const unsigned long PUBLISH_STEP_DELAY = 50; // ms between publishes
+    uint8_t _discEntity = 0;                         // Next MqttEntity in DISC_ENTITY
+
+    // Adaptive publish pacing
+    unsigned long _publishDelay = 0;                 // Current gap between bursts (0 = link keeps up)
+    uint32_t _publishStalls = 0;                     // Backpressure events since boot
+    uint32_t _statePublishes = 0;                    // State messages sent since boot
+    uint32_t _statePublishFailures = 0;              // State messages the client refused
+    bool _runActive = false;                         // A discovery/state run is in progress
+    unsigned long _runStart = 0;
+    uint16_t _runSteps = 0;
+    unsigned long _lastRunMs = 0;                    // Duration of the last completed run
+    uint16_t _lastRunSteps = 0;                      // Steps (publishes) in that run
+
+    // Dirty-field state publishing
+    uint16_t _dirtyFields = 0;                       // Bit per MqttStateField
+    uint32_t _publishedHash[MQTT_FIELD_COUNT];       // Hash of last published payload
+    bool _forceFullRefresh = true;                   // Republish everything (connect, safety net)
+
+    // JSON state mode - all fields serialised once into <base>/state
+    bool _jsonState = false;                         // Latched from settings on connect()
+    bool _deviceDiscovery = false;                   // Discovery format, latched on connect()
+    uint32_t _publishedJsonHash = 0;
+
+    // Event outbox (ring buffer, oldest at _outboxHead). The first
+    // _outboxSent entries are written but not yet confirmed.
+    MqttOutboxEntry _outbox[MQTT_OUTBOX_SIZE];
+    uint8_t _outboxHead = 0;
+    volatile uint8_t _outboxCount = 0;
+    volatile uint8_t _outboxSent = 0;
+    uint16_t _outboxSeq = 0;
+    unsigned long _lastOutboxSend = 0;
+    uint32_t _eventsSent = 0;
+    uint32_t _eventsReplayed = 0;                    // Resent after a reconnect
+    uint32_t _eventsDropped = 0;                     // Oldest entries lost to a full outbox
+    uint32_t _eventsCoalesced = 0;                   // Superseded before delivery
 
     CommandCallback _commandCallback = nullptr;
 
@@ -99,23 +256,26 @@ private:
     static MQTTHandler* _instance;
 
     void handleMessage(const char* topic, const char* payload);
+    void processConnect();
+    void connectFailed(int rc);
+    void onConnected();
+    void flushOutbox();
+    void confirmOutbox();
     void processPublishStateMachine();
+    void publishStep();
+    bool publishRoom();
+    void publishStalled();
+    void startStatePublish(bool full);
+    const char* renderStateField(uint8_t field, char* buf, size_t len);
+    size_t renderStateJson(char* buf, size_t len);
+
+    void startDiscovery();
+    uint32_t discoveryHash();
+    size_t renderDiscoveryBody(uint8_t entity, char* buf, size_t len, const char* base);
+    bool publishEntityDiscovery(uint8_t entity, const char* base);
+    bool publishDeviceDiscovery(const char* base);
+    size_t streamDeviceDiscovery(const char* base, bool send);
 
-    void publishFanDiscovery();
-    void publishIntervalSwitchDiscovery();
-    void publishIntervalOnTimeDiscovery();
-    void publishIntervalOffTimeDiscovery();
-    void publishRemainingTimeSensorDiscovery();
-    void publishRPMSensorDiscovery();
-    void publishWiFiSensorDiscovery();
-    void publishTotalRuntimeSensorDiscovery();
-    void publishUpdateAvailableBinarySensorDiscovery();
-    void publishLatestVersionSensorDiscovery();
-    void publishCurrentVersionSensorDiscovery();
-    void publishScentSensorDiscovery();
-    void publishCartridgeBinarySensorDiscovery();
-
-    String getBaseTopic();
 };
 
 extern MQTTHandler mqttHandler;
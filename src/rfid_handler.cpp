@@ -5,6 +5,7 @@
 #include <SPI.h>
 #include <MFRC522.h>
 #include "mqtt_handler.h"  // For state publish on cartridge change
+#include "state_version.h"
 
 // RC522 instance
 static MFRC522* mfrc522 = nullptr;
@@ -214,6 +215,7 @@ bool rfidInit() {
 
     if (version == 0x91 || version == 0x92 || version == 0x88) {
         rc522Connected = true;
+        bumpStateVersion();
         Serial.printf("[RFID] RC522 detected! Firmware version: 0x%02X", version);
         if (version == 0x91) Serial.println(" (v1.0)");
         else if (version == 0x92) Serial.println(" (v2.0)");
@@ -231,6 +233,7 @@ bool rfidInit() {
         return true;
     } else {
         rc522Connected = false;
+        bumpStateVersion();
         Serial.printf("[RFID] RC522 NOT detected! Got version: 0x%02X\n", version);
         if (version == 0x00) {
             Serial.println("[RFID] Version 0x00 suggests: no communication (check wiring/CS pin)");
@@ -261,7 +264,9 @@ void rfidLoop() {
     if (cartridgePresent && (now - lastTagTime > CARTRIDGE_TIMEOUT_MS)) {
         cartridgePresent = false;
         Serial.println("[RFID] Cartridge removed (timeout)");
+        bumpStateVersion();
         mqttHandler.requestStatePublish();  // Notify MQTT immediately
+        mqttHandler.queueEvent(MQTT_EVENT_CARTRIDGE, "\"present\":false");
     }
 
     // Scan niet te vaak (elke 1000ms)
@@ -464,8 +469,12 @@ void rfidLoop() {
     }
 #endif
 
-    // Notify MQTT of new cartridge
+    // Notify web UI and MQTT of new cartridge
+    bumpStateVersion();
     mqttHandler.requestStatePublish();
+    char fields[80];
+    snprintf(fields, sizeof(fields), "\"present\":true,\"scent\":\"%s\"", lastScent);
+    mqttHandler.queueEvent(MQTT_EVENT_CARTRIDGE, fields);
 
     // Halt PICC
     mfrc522->PICC_HaltA();
@@ -476,6 +485,10 @@ String rfidGetLastUID() {
     return String(lastUID);
 }
 
+const char* rfidGetLastUIDCStr() {
+    return lastUID;
+}
+
 String rfidGetLastScent() {
     return String(lastScent);
 }
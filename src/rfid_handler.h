@@ -25,6 +25,9 @@ String rfidGetLastUID();
 // Haal de laatst gedetecteerde geur op
 String rfidGetLastScent();
 
+// Same as rfidGetLastUID() without the String copy
+const char* rfidGetLastUIDCStr();
+
 // Same as rfidGetLastScent() but returns a const char* into the static buffer
 // (no heap allocation). Use this in hot paths like the MQTT state publisher.
 const char* rfidGetLastScentCStr();
@@ -0,0 +1,16 @@
+#ifndef STATE_VERSION_H
+#define STATE_VERSION_H
+
+#include <Arduino.h>
+
+// Version of everything /api/status/lite reports. Subsystems bump it on any
+// externally visible change, so the web server can answer a poll with
+// If-None-Match: "<version>" by a 304 without looking at the state at all.
+// Seeded randomly at boot, so an ETag from before a reboot never matches.
+extern volatile uint32_t stateVersion;
+
+inline void bumpStateVersion() {
+    stateVersion++;
+}
+
+#endif // STATE_VERSION_H
@@ -1,6 +1,8 @@
 #include "storage.h"
 #include "config.h"
 
+#include <stddef.h>
+
 #ifdef PLATFORM_ESP8266
     #include <EEPROM.h>
     #include <ESP8266WiFi.h>
@@ -10,11 +12,188 @@
     static Preferences prefs;
 #endif
 
+// Settings key table - maps every persisted field of DiffuserSettings to a
+// stable TLV tag (ESP8266 EEPROM) and an NVS key (ESP32). Tags are part of the
+// on-flash format: append new entries with a new tag, never renumber or reuse.
+enum class SettingType : uint8_t { STR, U8, BOOL, U16, U32 };
+struct SettingKey {
+    uint8_t tag;
+    const char* name;
+    SettingType type;
+    uint16_t offset;
+    uint8_t size;
+    uint16_t field;
+};
+#define SETTING_KEY(tag, key, type, member, field) \
+    { tag, key, SettingType::type, offsetof(DiffuserSettings, member), sizeof(DiffuserSettings::member), field }
+static constexpr SettingKey SETTING_KEYS[] = {
+    SETTING_KEY( 1, NVS_WIFI_SSID,        STR,  wifiSsid,            STORAGE_FIELD_WIFI),
+    SETTING_KEY( 2, NVS_WIFI_PASS,        STR,  wifiPassword,        STORAGE_FIELD_WIFI),
+    SETTING_KEY( 3, NVS_MQTT_HOST,        STR,  mqttHost,            STORAGE_FIELD_MQTT),
+    SETTING_KEY( 4, NVS_MQTT_PORT,        U16,  mqttPort,            STORAGE_FIELD_MQTT),
+    SETTING_KEY( 5, NVS_MQTT_USER,        STR,  mqttUser,            STORAGE_FIELD_MQTT),
+    SETTING_KEY( 6, NVS_MQTT_PASS,        STR,  mqttPassword,        STORAGE_FIELD_MQTT),
+    SETTING_KEY( 7, NVS_DEVICE_NAME,      STR,  deviceName,          STORAGE_FIELD_DEVICE_NAME),
+    SETTING_KEY( 8, NVS_FAN_SPEED,        U8,   fanSpeed,            STORAGE_FIELD_FAN_SPEED),
+    SETTING_KEY( 9, NVS_FAN_MIN_PWM,      U8,   fanMinPWM,           STORAGE_FIELD_FAN_MIN_PWM),
+    SETTING_KEY(10, NVS_INTERVAL_ENABLED, BOOL, intervalEnabled,     STORAGE_FIELD_INTERVAL),
+    SETTING_KEY(11, NVS_INTERVAL_ON,      U8,   intervalOnTime,      STORAGE_FIELD_INTERVAL),
+    SETTING_KEY(12, NVS_INTERVAL_OFF,     U8,   intervalOffTime,     STORAGE_FIELD_INTERVAL),
+    SETTING_KEY(13, NVS_TOTAL_RUNTIME,    U32,  totalRuntimeMinutes, STORAGE_FIELD_RUNTIME),
+    SETTING_KEY(14, NVS_OTA_PASSWORD,     STR,  otaPassword,         STORAGE_FIELD_OTA_PASSWORD),
+    SETTING_KEY(15, NVS_AP_PASSWORD,      STR,  apPassword,          STORAGE_FIELD_AP_PASSWORD),
+    SETTING_KEY(16, NVS_NIGHT_ENABLED,    BOOL, nightModeEnabled,    STORAGE_FIELD_NIGHT_MODE),
+    SETTING_KEY(17, NVS_NIGHT_START,      U8,   nightModeStart,      STORAGE_FIELD_NIGHT_MODE),
+    SETTING_KEY(18, NVS_NIGHT_END,        U8,   nightModeEnd,        STORAGE_FIELD_NIGHT_MODE),
+    SETTING_KEY(19, NVS_NIGHT_BRIGHT,     U8,   nightModeBrightness, STORAGE_FIELD_NIGHT_MODE),
+    SETTING_KEY(22, NVS_MQTT_JSON_STATE,  BOOL, mqttJsonState,       STORAGE_FIELD_MQTT),
+    SETTING_KEY(23, NVS_DISCOVERY_HASH,   U32,  discoveryHash,       STORAGE_FIELD_MQTT),
+    SETTING_KEY(24, NVS_TELEMETRY,        U8,   telemetryInterval,   STORAGE_FIELD_MQTT),
+    SETTING_KEY(25, NVS_MQTT_DEVICE_DISC, BOOL, mqttDeviceDiscovery, STORAGE_FIELD_MQTT),
+#ifdef PLATFORM_ESP8266
+    // EEPROM-only fields (not persisted in NVS on ESP32)
+    SETTING_KEY(20, nullptr,              STR,  lastKnownVersion,    0),
+    SETTING_KEY(21, nullptr,              BOOL, updateAvailable,     0),
+#endif
+};
+static const uint8_t SETTING_KEY_COUNT = sizeof(SETTING_KEYS) / sizeof(SETTING_KEYS[0]);
+
+#ifdef PLATFORM_ESP8266
+// EEPROM layout: header followed by tag-length-value records.
+// Unknown tags are skipped and missing tags keep their defaults, so adding a
+// field never invalidates the stored WiFi credentials.
+struct SettingsBlobHeader {
+    uint32_t magic;     // SETTINGS_TLV_MAGIC
+    uint16_t length;    // Payload bytes following the header
+    uint16_t checksum;  // Fletcher-16 over the payload
+};
+#define SETTINGS_TLV_MAGIC 0x31564C54  // "TLV1"
+
+// Raw struct layout written by firmware up to v1.9.9 (SETTINGS_MAGIC v6).
+// Frozen here so it can still be migrated after DiffuserSettings changes.
+struct DiffuserSettingsV6 {
+    uint32_t magic;
+    char wifiSsid[64];
+    char wifiPassword[64];
+    char mqttHost[64];
+    uint16_t mqttPort;
+    char mqttUser[32];
+    char mqttPassword[64];
+    char deviceName[32];
+    uint8_t fanSpeed;
+    uint8_t fanMinPWM;
+    bool intervalEnabled;
+    uint8_t intervalOnTime;
+    uint8_t intervalOffTime;
+    char otaPassword[32];
+    char apPassword[32];
+    uint32_t totalRuntimeMinutes;
+    bool nightModeEnabled;
+    uint8_t nightModeStart;
+    uint8_t nightModeEnd;
+    uint8_t nightModeBrightness;
+    char lastKnownVersion[16];
+    bool updateAvailable;
+};
+
+// Worst case encoded size: every record at its full width
+static constexpr size_t tlvMaxSize(uint8_t i = 0) {
+    return i < SETTING_KEY_COUNT ? 2 + SETTING_KEYS[i].size + tlvMaxSize(i + 1) : 0;
+}
+static constexpr size_t SETTINGS_TLV_MAX = sizeof(SettingsBlobHeader) + tlvMaxSize();
+// EEPROM must also hold a legacy blob until it has been migrated
+#define SETTINGS_EEPROM_SIZE \
+    (SETTINGS_TLV_MAX > sizeof(DiffuserSettingsV6) ? SETTINGS_TLV_MAX : sizeof(DiffuserSettingsV6))
+
+static uint16_t fletcher16(const uint8_t* data, size_t len) {
+    uint16_t sum1 = 0, sum2 = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+// Encode all settings into out, returns payload length
+static size_t encodeSettingsTlv(const DiffuserSettings& settings, uint8_t* out, size_t capacity) {
+    size_t pos = 0;
+    for (uint8_t i = 0; i < SETTING_KEY_COUNT; i++) {
+        const SettingKey& key = SETTING_KEYS[i];
+        const uint8_t* value = (const uint8_t*)&settings + key.offset;
+
+        // Strings are stored without padding or terminator - most are near empty
+        size_t len = (key.type == SettingType::STR) ? strnlen((const char*)value, key.size - 1) : key.size;
+        if (key.type == SettingType::STR && len == 0) continue;  // Missing tag = empty string
+        if (pos + 2 + len > capacity) break;
+
+        out[pos++] = key.tag;
+        out[pos++] = (uint8_t)len;
+        memcpy(out + pos, value, len);
+        pos += len;
+    }
+    return pos;
+}
+
+// Decode records into settings (which must be zeroed), skipping unknown tags
+static void decodeSettingsTlv(const uint8_t* in, size_t length, DiffuserSettings& settings) {
+    size_t pos = 0;
+    while (pos + 2 <= length) {
+        uint8_t tag = in[pos];
+        uint8_t len = in[pos + 1];
+        pos += 2;
+        if (pos + len > length) break;  // Truncated record
+
+        for (uint8_t i = 0; i < SETTING_KEY_COUNT; i++) {
+            const SettingKey& key = SETTING_KEYS[i];
+            if (key.tag != tag) continue;
+
+            uint8_t* value = (uint8_t*)&settings + key.offset;
+            if (key.type == SettingType::STR) {
+                size_t n = len < key.size ? len : key.size - 1;
+                memcpy(value, in + pos, n);
+                value[n] = '\0';
+            } else {
+                // Little-endian, so a narrower stored value widens correctly
+                memcpy(value, in + pos, len < key.size ? len : key.size);
+            }
+            break;
+        }
+        pos += len;
+    }
+}
+
+static void migrateSettingsV6(const DiffuserSettingsV6& legacy, DiffuserSettings& settings) {
+    strlcpy(settings.wifiSsid, legacy.wifiSsid, sizeof(settings.wifiSsid));
+    strlcpy(settings.wifiPassword, legacy.wifiPassword, sizeof(settings.wifiPassword));
+    strlcpy(settings.mqttHost, legacy.mqttHost, sizeof(settings.mqttHost));
+    settings.mqttPort = legacy.mqttPort;
+    strlcpy(settings.mqttUser, legacy.mqttUser, sizeof(settings.mqttUser));
+    strlcpy(settings.mqttPassword, legacy.mqttPassword, sizeof(settings.mqttPassword));
+    strlcpy(settings.deviceName, legacy.deviceName, sizeof(settings.deviceName));
+    settings.fanSpeed = legacy.fanSpeed;
+    settings.fanMinPWM = legacy.fanMinPWM;
+    settings.intervalEnabled = legacy.intervalEnabled;
+    settings.intervalOnTime = legacy.intervalOnTime;
+    settings.intervalOffTime = legacy.intervalOffTime;
+    strlcpy(settings.otaPassword, legacy.otaPassword, sizeof(settings.otaPassword));
+    strlcpy(settings.apPassword, legacy.apPassword, sizeof(settings.apPassword));
+    settings.totalRuntimeMinutes = legacy.totalRuntimeMinutes;
+    settings.nightModeEnabled = legacy.nightModeEnabled;
+    settings.nightModeStart = legacy.nightModeStart;
+    settings.nightModeEnd = legacy.nightModeEnd;
+    settings.nightModeBrightness = legacy.nightModeBrightness;
+    strlcpy(settings.lastKnownVersion, legacy.lastKnownVersion, sizeof(settings.lastKnownVersion));
+    settings.updateAvailable = legacy.updateAvailable;
+}
+#else
+static_assert(SETTING_KEY_COUNT == Storage::NVS_KEY_COUNT, "NVS_KEY_COUNT out of sync");
+#endif
+
 Storage storage;
 
 void Storage::begin() {
 #ifdef PLATFORM_ESP8266
-    EEPROM.begin(sizeof(DiffuserSettings) + 16);  // Extra padding
+    EEPROM.begin(SETTINGS_EEPROM_SIZE);
     Serial.println("[STORAGE] EEPROM initialized");
 #else
     prefs.begin(NVS_NAMESPACE, false);
@@ -24,6 +203,20 @@ void Storage::begin() {
     // Load settings on init
     _settings = load();
     _loaded = true;
+
+#ifndef PLATFORM_ESP8266
+    // Baseline for diff-based writes: what NVS holds right now
+    _persisted = _settings;
+#endif
+}
+
+void Storage::loop() {
+    if (_dirtyFields == 0) return;
+
+    // Only commit once the value has settled (e.g. slider released)
+    if (millis() - _lastChange >= STORAGE_COMMIT_QUIET_MS) {
+        flush();
+    }
 }
 
 DiffuserSettings Storage::load() {
@@ -31,19 +224,27 @@ DiffuserSettings Storage::load() {
     memset(&settings, 0, sizeof(settings));
 
 #ifdef PLATFORM_ESP8266
-    EEPROM.get(0, settings);
-
-    // Check magic number
-    if (settings.magic != SETTINGS_MAGIC) {
+    const uint8_t* data = EEPROM.getConstDataPtr();
+    SettingsBlobHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool needsSave = false;
+
+    if (header.magic == SETTINGS_TLV_MAGIC &&
+        header.length <= SETTINGS_EEPROM_SIZE - sizeof(header) &&
+        fletcher16(data + sizeof(header), header.length) == header.checksum) {
+        decodeSettingsTlv(data + sizeof(header), header.length, settings);
+    } else if (header.magic == SETTINGS_MAGIC) {
+        // Raw struct from an older firmware - convert in place, keep WiFi
+        DiffuserSettingsV6 legacy;
+        EEPROM.get(0, legacy);
+        migrateSettingsV6(legacy, settings);
+        needsSave = true;
+        Serial.println("[STORAGE] Migrated v6 settings to TLV format");
+    } else {
         Serial.println("[STORAGE] No valid settings found, initializing defaults");
-        memset(&settings, 0, sizeof(settings));
-        settings.magic = SETTINGS_MAGIC;
-        ensureDefaults(settings);
-        // Persist defaults to EEPROM so we don't reinitialize every boot
-        EEPROM.put(0, settings);
-        EEPROM.commit();
-        Serial.println("[STORAGE] Defaults saved to EEPROM");
+        needsSave = true;
     }
+    settings.magic = SETTINGS_MAGIC;
 #else
     // ESP32: Use Preferences
     String ssid = prefs.getString(NVS_WIFI_SSID, "");
@@ -58,11 +259,16 @@ DiffuserSettings Storage::load() {
     strlcpy(settings.mqttHost, mqttHost.c_str(), sizeof(settings.mqttHost));
     strlcpy(settings.mqttUser, mqttUser.c_str(), sizeof(settings.mqttUser));
     strlcpy(settings.mqttPassword, mqttPass.c_str(), sizeof(settings.mqttPassword));
+    settings.mqttJsonState = prefs.getBool(NVS_MQTT_JSON_STATE, false);
+    settings.discoveryHash = prefs.getULong(NVS_DISCOVERY_HASH, 0);
+    settings.telemetryInterval = prefs.getUChar(NVS_TELEMETRY, 0);
+    settings.mqttDeviceDiscovery = prefs.getBool(NVS_MQTT_DEVICE_DISC, false);
 
     String deviceName = prefs.getString(NVS_DEVICE_NAME, "Rituals Diffuser");
     strlcpy(settings.deviceName, deviceName.c_str(), sizeof(settings.deviceName));
 
     settings.fanSpeed = prefs.getUChar(NVS_FAN_SPEED, 50);
+    settings.fanMinPWM = prefs.getUChar(NVS_FAN_MIN_PWM, 0);
     settings.intervalEnabled = prefs.getBool(NVS_INTERVAL_ENABLED, false);
     settings.intervalOnTime = prefs.getUChar(NVS_INTERVAL_ON, INTERVAL_ON_DEFAULT);
     settings.intervalOffTime = prefs.getUChar(NVS_INTERVAL_OFF, INTERVAL_OFF_DEFAULT);
@@ -82,6 +288,16 @@ DiffuserSettings Storage::load() {
 #endif
 
     ensureDefaults(settings);
+
+#ifdef PLATFORM_ESP8266
+    // Persist migrated/default settings so we don't redo this every boot
+    if (needsSave) {
+        _settings = settings;
+        writeFields(STORAGE_FIELD_ALL);
+        Serial.println("[STORAGE] Settings saved to EEPROM");
+    }
+#endif
+
     Serial.println("[STORAGE] Settings loaded");
     return settings;
 }
@@ -90,42 +306,95 @@ void Storage::save(const DiffuserSettings& settings) {
     _settings = settings;
     _settings.magic = SETTINGS_MAGIC;
 
-#ifdef PLATFORM_ESP8266
-    EEPROM.put(0, _settings);
-    EEPROM.commit();
-#else
-    prefs.putString(NVS_WIFI_SSID, settings.wifiSsid);
-    prefs.putString(NVS_WIFI_PASS, settings.wifiPassword);
-    prefs.putString(NVS_MQTT_HOST, settings.mqttHost);
-    prefs.putUShort(NVS_MQTT_PORT, settings.mqttPort);
-    prefs.putString(NVS_MQTT_USER, settings.mqttUser);
-    prefs.putString(NVS_MQTT_PASS, settings.mqttPassword);
-    prefs.putString(NVS_DEVICE_NAME, settings.deviceName);
-    prefs.putUChar(NVS_FAN_SPEED, settings.fanSpeed);
-    prefs.putBool(NVS_INTERVAL_ENABLED, settings.intervalEnabled);
-    prefs.putUChar(NVS_INTERVAL_ON, settings.intervalOnTime);
-    prefs.putUChar(NVS_INTERVAL_OFF, settings.intervalOffTime);
-    // OTA/AP passwords
-    prefs.putString(NVS_OTA_PASSWORD, settings.otaPassword);
-    prefs.putString(NVS_AP_PASSWORD, settings.apPassword);
-    // Night mode
-    prefs.putBool(NVS_NIGHT_ENABLED, settings.nightModeEnabled);
-    prefs.putUChar(NVS_NIGHT_START, settings.nightModeStart);
-    prefs.putUChar(NVS_NIGHT_END, settings.nightModeEnd);
-    prefs.putUChar(NVS_NIGHT_BRIGHT, settings.nightModeBrightness);
-#endif
+    writeFields(STORAGE_FIELD_ALL);
+    _dirtyFields = 0;
+    _pendingWrites = 0;
+    _flushCount++;
 
     Serial.println("[STORAGE] Settings saved");
 }
 
-void Storage::commit() {
-    save(_settings);
+void Storage::flush() {
+    if (_dirtyFields == 0 || _batchDepth > 0) return;
+
+    writeFields(_dirtyFields);
+
+    // Everything beyond the first setter call since the last commit was absorbed
+    if (_pendingWrites > 1) {
+        _coalescedWrites += _pendingWrites - 1;
+    }
+    Serial.printf("[STORAGE] Flushed fields 0x%03x (%lu changes, 1 commit)\n",
+                  _dirtyFields, (unsigned long)_pendingWrites);
+
+    _dirtyFields = 0;
+    _pendingWrites = 0;
+    _flushCount++;
+}
+
+void Storage::endBatch() {
+    if (_batchDepth == 0) return;
+    if (--_batchDepth == 0) flush();
+}
+
+void Storage::markDirty(uint16_t fields) {
+    _dirtyFields |= fields;
+    _lastChange = millis();
+    _pendingWrites++;
+}
+
+void Storage::writeFields(uint16_t fields) {
+    _settings.magic = SETTINGS_MAGIC;
+
+#ifdef PLATFORM_ESP8266
+    // EEPROM is committed as a whole sector, so every field goes out at once.
+    // Encode straight into the EEPROM cache to avoid a second buffer.
+    (void)fields;
+    uint8_t* data = EEPROM.getDataPtr();
+    SettingsBlobHeader header;
+    header.magic = SETTINGS_TLV_MAGIC;
+    header.length = encodeSettingsTlv(_settings, data + sizeof(header), SETTINGS_EEPROM_SIZE - sizeof(header));
+    header.checksum = fletcher16(data + sizeof(header), header.length);
+    memcpy(data, &header, sizeof(header));
+    EEPROM.commit();
+    _pendingRuntimeMinutes = 0;
+#else
+    // ESP32: Compare every key against what was last written to NVS and only
+    // put the ones that actually changed. Each put burns entries in the
+    // wear-levelled NVS pages and takes several milliseconds.
+    for (uint8_t i = 0; i < NVS_KEY_COUNT; i++) {
+        const SettingKey& key = SETTING_KEYS[i];
+        if (!(fields & key.field)) continue;
+
+        const uint8_t* cur = (const uint8_t*)&_settings + key.offset;
+        uint8_t* old = (uint8_t*)&_persisted + key.offset;
+
+        bool changed = (key.type == SettingType::STR)
+            ? strncmp((const char*)cur, (const char*)old, key.size) != 0
+            : memcmp(cur, old, key.size) != 0;
+        if (!changed) continue;
+
+        switch (key.type) {
+            case SettingType::STR:  prefs.putString(key.name, (const char*)cur); break;
+            case SettingType::U8:   prefs.putUChar(key.name, *cur); break;
+            case SettingType::BOOL: prefs.putBool(key.name, *(const bool*)cur); break;
+            case SettingType::U16:  prefs.putUShort(key.name, *(const uint16_t*)cur); break;
+            case SettingType::U32:  prefs.putULong(key.name, *(const uint32_t*)cur); break;
+        }
+        memcpy(old, cur, key.size);
+        _nvsWrites[i]++;
+    }
+    if (fields & STORAGE_FIELD_RUNTIME) {
+        _pendingRuntimeMinutes = 0;
+    }
+#endif
 }
 
 void Storage::setWiFi(const char* ssid, const char* password) {
     strlcpy(_settings.wifiSsid, ssid, sizeof(_settings.wifiSsid));
     strlcpy(_settings.wifiPassword, password, sizeof(_settings.wifiPassword));
-    commit();
+    // Credentials are committed immediately - losing them means a site visit
+    markDirty(STORAGE_FIELD_WIFI);
+    flush();
     Serial.println("[STORAGE] WiFi credentials saved");
 }
 
@@ -134,44 +403,79 @@ void Storage::setMQTT(const char* host, uint16_t port, const char* user, const c
     _settings.mqttPort = port;
     strlcpy(_settings.mqttUser, user, sizeof(_settings.mqttUser));
     strlcpy(_settings.mqttPassword, password, sizeof(_settings.mqttPassword));
-    commit();
+    markDirty(STORAGE_FIELD_MQTT);
+    flush();
     Serial.println("[STORAGE] MQTT config saved");
 }
 
+void Storage::setMqttJsonState(bool enabled) {
+    if (_settings.mqttJsonState != enabled) {
+        _settings.mqttJsonState = enabled;
+        markDirty(STORAGE_FIELD_MQTT);
+        flush();
+        Serial.printf("[STORAGE] MQTT JSON state: %s\n", enabled ? "ON" : "OFF");
+    }
+}
+
+void Storage::setMqttDeviceDiscovery(bool enabled) {
+    if (_settings.mqttDeviceDiscovery != enabled) {
+        _settings.mqttDeviceDiscovery = enabled;
+        markDirty(STORAGE_FIELD_MQTT);
+        flush();
+        Serial.printf("[STORAGE] MQTT device discovery: %s\n", enabled ? "ON" : "OFF");
+    }
+}
+
+void Storage::setTelemetryInterval(uint8_t seconds) {
+    if (_settings.telemetryInterval != seconds) {
+        _settings.telemetryInterval = seconds;
+        markDirty(STORAGE_FIELD_MQTT);
+        flush();
+        Serial.printf("[STORAGE] Telemetry interval: %ds\n", seconds);
+    }
+}
+
+// Deferred: losing it to a reboot only costs one extra discovery publish
+void Storage::setDiscoveryHash(uint32_t hash) {
+    if (_settings.discoveryHash != hash) {
+        _settings.discoveryHash = hash;
+        markDirty(STORAGE_FIELD_MQTT);
+    }
+}
+
 void Storage::setDeviceName(const char* name) {
     strlcpy(_settings.deviceName, name, sizeof(_settings.deviceName));
-    commit();
+    markDirty(STORAGE_FIELD_DEVICE_NAME);
     Serial.println("[STORAGE] Device name saved");
 }
 
 void Storage::setFanSpeed(uint8_t speed) {
-    // Only save if value actually changed (reduces flash wear)
+    // Only mark dirty if value actually changed; loop() commits once the
+    // slider has stopped moving (reduces flash wear)
     if (_settings.fanSpeed != speed) {
         _settings.fanSpeed = speed;
-        commit();
+        markDirty(STORAGE_FIELD_FAN_SPEED);
     }
 }
 
 void Storage::setFanMinPWM(uint8_t minPWM) {
     _settings.fanMinPWM = minPWM;
-#ifdef PLATFORM_ESP8266
-    commit();
-#else
-    // ESP32: Save directly to NVS to ensure persistence
-    prefs.putUChar(NVS_FAN_MIN_PWM, minPWM);
-#endif
+    // Calibration result is rare and expensive to redo, commit immediately
+    markDirty(STORAGE_FIELD_FAN_MIN_PWM);
+    flush();
     Serial.printf("[STORAGE] Fan minPWM saved: %d\n", minPWM);
 }
 
 uint8_t Storage::getFanMinPWM() {
-#ifdef PLATFORM_ESP8266
     return _settings.fanMinPWM;
-#else
-    // ESP32: Read directly from NVS
-    return prefs.getUChar(NVS_FAN_MIN_PWM, 0);
-#endif
 }
 
+#ifndef PLATFORM_ESP8266
+const char* Storage::getNvsKeyName(uint8_t index) {
+    return index < NVS_KEY_COUNT ? SETTING_KEYS[index].name : "";
+}
+#endif
+
 void Storage::setIntervalMode(bool enabled, uint8_t onTime, uint8_t offTime) {
     // Only save if values actually changed (reduces flash wear)
     if (_settings.intervalEnabled != enabled ||
@@ -180,20 +484,22 @@ void Storage::setIntervalMode(bool enabled, uint8_t onTime, uint8_t offTime) {
         _settings.intervalEnabled = enabled;
         _settings.intervalOnTime = onTime;
         _settings.intervalOffTime = offTime;
-        commit();
-        Serial.println("[STORAGE] Interval settings saved");
+        markDirty(STORAGE_FIELD_INTERVAL);
+        Serial.println("[STORAGE] Interval settings updated");
     }
 }
 
 void Storage::setOTAPassword(const char* password) {
     strlcpy(_settings.otaPassword, password, sizeof(_settings.otaPassword));
-    commit();
+    markDirty(STORAGE_FIELD_OTA_PASSWORD);
+    flush();
     Serial.println("[STORAGE] OTA password saved");
 }
 
 void Storage::setAPPassword(const char* password) {
     strlcpy(_settings.apPassword, password, sizeof(_settings.apPassword));
-    commit();
+    markDirty(STORAGE_FIELD_AP_PASSWORD);
+    flush();
     Serial.println("[STORAGE] AP password saved");
 }
 
@@ -228,14 +534,21 @@ bool Storage::hasMQTTConfig() {
 }
 
 void Storage::reset() {
+    // Drop pending changes so a later flush() can't resurrect old settings
+    _dirtyFields = 0;
+    _pendingWrites = 0;
+
     memset(&_settings, 0, sizeof(_settings));
     _settings.magic = 0;  // Invalidate magic
 
 #ifdef PLATFORM_ESP8266
-    EEPROM.put(0, _settings);
+    SettingsBlobHeader header;
+    memset(&header, 0, sizeof(header));  // No valid magic = defaults on next boot
+    EEPROM.put(0, header);
     EEPROM.commit();
 #else
     prefs.clear();
+    memset(&_persisted, 0, sizeof(_persisted));
 #endif
 
     Serial.println("[STORAGE] Factory reset complete");
@@ -268,27 +581,23 @@ void Storage::addRuntimeMinutes(uint32_t minutes) {
     // ESP8266: Batch writes to reduce flash wear (~100K cycle limit)
     // Only commit to EEPROM every 6 hours or when flushRuntime() is called (fan off)
     if (_pendingRuntimeMinutes >= 360) {
-        commit();
-        _pendingRuntimeMinutes = 0;
+        markDirty(STORAGE_FIELD_RUNTIME);
+        flush();
         Serial.printf("[STORAGE] Runtime saved: %lu minutes\n", _settings.totalRuntimeMinutes);
     }
 #else
     // ESP32: NVS has wear leveling, safe to write more often
-    prefs.putULong(NVS_TOTAL_RUNTIME, _settings.totalRuntimeMinutes);
-    _pendingRuntimeMinutes = 0;
+    markDirty(STORAGE_FIELD_RUNTIME);
+    flush();
     Serial.printf("[STORAGE] Runtime saved: %lu minutes\n", _settings.totalRuntimeMinutes);
 #endif
 }
 
 void Storage::flushRuntime() {
     if (_pendingRuntimeMinutes == 0) return;
-#ifdef PLATFORM_ESP8266
-    commit();
-#else
-    prefs.putULong(NVS_TOTAL_RUNTIME, _settings.totalRuntimeMinutes);
-#endif
+    markDirty(STORAGE_FIELD_RUNTIME);
+    flush();
     Serial.printf("[STORAGE] Runtime flushed: %lu minutes\n", _settings.totalRuntimeMinutes);
-    _pendingRuntimeMinutes = 0;
 }
 
 uint32_t Storage::getTotalRuntimeMinutes() {
@@ -301,7 +610,7 @@ void Storage::setNightMode(bool enabled, uint8_t startHour, uint8_t endHour, uin
     _settings.nightModeStart = startHour;
     _settings.nightModeEnd = endHour;
     _settings.nightModeBrightness = brightness;
-    commit();
+    markDirty(STORAGE_FIELD_NIGHT_MODE);
     Serial.printf("[STORAGE] Night mode: %s (%02d:00-%02d:00, %d%% brightness)\n",
                   enabled ? "ON" : "OFF", startHour, endHour, brightness);
 }
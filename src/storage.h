@@ -45,11 +45,19 @@ struct DiffuserSettings {
     // Update Checker (v6)
     char lastKnownVersion[16];    // Last version seen from GitHub
     bool updateAvailable;          // Cached update availability
+
+    // MQTT options (TLV only)
+    bool mqttJsonState;            // Publish all state as one JSON payload on <base>/state
+    uint32_t discoveryHash;        // Hash of the last fully published HA discovery (0 = none)
+    uint8_t telemetryInterval;     // Telemetry sample period in seconds (0 = off)
+    bool mqttDeviceDiscovery;      // One HA device discovery config (HA 2024.11+) instead of one per entity
 };
 
-// Magic number for valid settings validation
+// Magic number of the legacy raw-struct EEPROM format (ESP8266)
 // Format: 0xD1FF00XX where XX is the version number
-// Increment version when struct layout changes to invalidate old settings
+// Settings are now stored as tag-length-value records (see storage.cpp)
+// and this layout is only read to migrate existing devices. Do NOT bump it:
+// add new fields with a new TLV tag instead - old settings survive upgrades.
 // v1 (0x01): Initial version
 // v2 (0x02): Added interval mode fields
 // v3 (0x03): Added OTA/AP passwords
@@ -58,9 +66,27 @@ struct DiffuserSettings {
 // v6 (0x06): Added update checker fields
 #define SETTINGS_MAGIC 0xD1FF0006
 
+// Dirty field flags for the write-back cache.
+// Setters update the cached struct and mark the field dirty; loop() commits
+// once the value has been stable for STORAGE_COMMIT_QUIET_MS.
+enum StorageField : uint16_t {
+    STORAGE_FIELD_WIFI          = 1 << 0,
+    STORAGE_FIELD_MQTT          = 1 << 1,
+    STORAGE_FIELD_DEVICE_NAME   = 1 << 2,
+    STORAGE_FIELD_FAN_SPEED     = 1 << 3,
+    STORAGE_FIELD_FAN_MIN_PWM   = 1 << 4,
+    STORAGE_FIELD_INTERVAL      = 1 << 5,
+    STORAGE_FIELD_OTA_PASSWORD  = 1 << 6,
+    STORAGE_FIELD_AP_PASSWORD   = 1 << 7,
+    STORAGE_FIELD_RUNTIME       = 1 << 8,
+    STORAGE_FIELD_NIGHT_MODE    = 1 << 9,
+    STORAGE_FIELD_ALL           = 0x03FF
+};
+
 class Storage {
 public:
     void begin();
+    void loop();  // Commits deferred changes once they have been stable
 
     // Load all settings (from NVS - use sparingly)
     DiffuserSettings load();
@@ -74,6 +100,10 @@ public:
     // Individual setters
     void setWiFi(const char* ssid, const char* password);
     void setMQTT(const char* host, uint16_t port, const char* user, const char* password);
+    void setMqttJsonState(bool enabled);
+    void setMqttDeviceDiscovery(bool enabled);
+    void setDiscoveryHash(uint32_t hash);
+    void setTelemetryInterval(uint8_t seconds);
     void setDeviceName(const char* name);
     void setFanSpeed(uint8_t speed);
     void setFanMinPWM(uint8_t minPWM);
@@ -103,16 +133,53 @@ public:
     // Check if MQTT is configured
     bool hasMQTTConfig();
 
-    // Factory reset
+    // Factory reset (discards pending changes)
     void reset();
 
+    // Write-back cache
+    // flush() commits pending changes immediately - call before ESP.restart(),
+    // OTA start and anything else that may not return to loop().
+    void flush();
+    bool hasPendingChanges() const { return _dirtyFields != 0; }
+    uint16_t getDirtyFields() const { return _dirtyFields; }
+    uint32_t getPendingWrites() const { return _pendingWrites; }    // Setter calls since last flush
+    uint32_t getFlushCount() const { return _flushCount; }          // Flash commits performed
+    uint32_t getCoalescedWrites() const { return _coalescedWrites; } // Setter calls absorbed by a later commit
+
+    // Batch: flush() between beginBatch() and endBatch() is deferred, so a
+    // group of setters (even those that commit immediately) costs one commit
+    void beginBatch() { _batchDepth++; }
+    void endBatch();
+
+#ifndef PLATFORM_ESP8266
+    // NVS write statistics (ESP32) - one counter per key since boot
+    static const uint8_t NVS_KEY_COUNT = 23;
+    const char* getNvsKeyName(uint8_t index);
+    uint16_t getNvsWriteCount(uint8_t index) const { return index < NVS_KEY_COUNT ? _nvsWrites[index] : 0; }
+#endif
+
 private:
     DiffuserSettings _settings;
     bool _loaded = false;
     uint32_t _pendingRuntimeMinutes = 0;
 
+    // Write-back state
+    uint16_t _dirtyFields = 0;
+    unsigned long _lastChange = 0;
+    uint32_t _pendingWrites = 0;
+    uint32_t _flushCount = 0;
+    uint32_t _coalescedWrites = 0;
+    uint8_t _batchDepth = 0;
+
+#ifndef PLATFORM_ESP8266
+    // Last values written to NVS - writeFields() only puts keys that differ
+    DiffuserSettings _persisted;
+    uint16_t _nvsWrites[NVS_KEY_COUNT] = {0};
+#endif
+
     void ensureDefaults(DiffuserSettings& settings);
-    void commit();
+    void markDirty(uint16_t fields);
+    void writeFields(uint16_t fields);
 };
 
 extern Storage storage;
@@ -10,6 +10,8 @@
 #include "wifi_manager.h"
 #include "mqtt_handler.h"
 #include "led_controller.h"
+#include "storage.h"
+#include "history.h"
 // Note: Don't include logger.h - we avoid flash writes during OTA
 
 // External variables from main.cpp
@@ -118,6 +120,11 @@ void runSyncOTAServer() {
     Serial.println("[OTA-SYNC] Starting synchronous OTA server...");
     // Note: Don't use logger during OTA - it writes to flash which can conflict
 
+    // Commit deferred settings and history now - this function only exits
+    // via ESP.restart()
+    storage.flush();
+    history.checkpoint();
+
     // Stop MQTT to free memory and prevent interference
     mqttHandler.disconnect();
     Serial.println("[OTA-SYNC] MQTT disconnected");
@@ -0,0 +1,122 @@
+#include "telemetry.h"
+#include "fan_controller.h"
+#include "wifi_manager.h"
+#include "mqtt_handler.h"
+
+Telemetry telemetry;
+
+// Payload buffer, only used while rendering a batch in loop()
+static char _telemetryBuf[TELEMETRY_PAYLOAD_SIZE];
+
+void Telemetry::begin(uint8_t intervalSeconds) {
+    _interval = intervalSeconds > TELEMETRY_INTERVAL_MAX ? TELEMETRY_INTERVAL_MAX : intervalSeconds;
+    _count = 0;
+    if (_interval > 0) {
+        Serial.printf("[TELEMETRY] Sampling every %ds, %d samples per batch\n", _interval, TELEMETRY_BATCH);
+    }
+}
+
+void Telemetry::setInterval(uint8_t seconds) {
+    _interval = seconds > TELEMETRY_INTERVAL_MAX ? TELEMETRY_INTERVAL_MAX : seconds;
+    _resetPending = true;
+}
+
+void Telemetry::loop() {
+    if (_resetPending) {
+        // A batch must have one sample period throughout
+        _resetPending = false;
+        _count = 0;
+        _lastSample = 0;        // First sample of the new period right away
+        Serial.printf("[TELEMETRY] Interval: %ds%s\n", _interval, _interval ? "" : " (off)");
+    }
+    if (_interval == 0) return;
+
+    unsigned long now = millis();
+    // Gate on the last sample, not the batch: the first sample of the next
+    // batch is one period after the last one of the previous batch
+    if (_lastSample && now - _lastSample < _interval * 1000UL) return;
+    _lastSample = now;
+
+    sample();
+    if (_count >= TELEMETRY_BATCH) {
+        publishBatch();
+        _count = 0;
+    }
+}
+
+void Telemetry::sample() {
+    if (_count == 0) {
+        _firstUptime = millis() / 1000;
+        time_t epoch = time(nullptr);
+        _firstEpoch = epoch > 1000000000 ? epoch : 0;
+    }
+
+    TelemetrySample& s = _samples[_count++];
+    s.heap = ESP.getFreeHeap();
+    s.rpm = fanController.getRPM();
+    s.pwm = fanController.getCurrentPWMValue();
+    s.rssi = wifiManager.isConnected() ? wifiManager.getRSSI() : 0;
+}
+
+void Telemetry::publishBatch() {
+    size_t len = render(_telemetryBuf, sizeof(_telemetryBuf));
+    if (len == 0) {
+        _batchesDropped++;
+        Serial.println("[TELEMETRY] Batch too large, dropped");
+        return;
+    }
+    // Telemetry is lossy by design - no outbox, a batch without a broker is dropped
+    if (mqttHandler.publishTelemetry(_telemetryBuf, len)) {
+        _batchesSent++;
+    } else {
+        _batchesDropped++;
+    }
+}
+
+// Render the batch as compact JSON. Each series holds the first value followed
+// by the difference to the previous sample, which keeps steady metrics to one
+// or two characters per sample:
+// {"up":120,"ts":1700000000,"dt":1,"rpm":[1480,2,-3],"pwm":[128,0,0],...}
+// Returns the length, or 0 if it did not fit.
+size_t Telemetry::render(char* buf, size_t len) {
+    size_t pos = 0;
+    int n = snprintf(buf, len, "{\"up\":%lu", (unsigned long)_firstUptime);
+    if (n < 0 || (size_t)n >= len) return 0;
+    pos = n;
+    if (_firstEpoch) {
+        n = snprintf(buf + pos, len - pos, ",\"ts\":%ld", (long)_firstEpoch);
+        if (n < 0 || (size_t)n >= len - pos) return 0;
+        pos += n;
+    }
+    n = snprintf(buf + pos, len - pos, ",\"dt\":%d", _interval);
+    if (n < 0 || (size_t)n >= len - pos) return 0;
+    pos += n;
+
+    static const char* const names[] = {"rpm", "pwm", "rssi", "heap"};
+    for (uint8_t series = 0; series < 4; series++) {
+        n = snprintf(buf + pos, len - pos, ",\"%s\":[", names[series]);
+        if (n < 0 || (size_t)n >= len - pos) return 0;
+        pos += n;
+
+        long prev = 0;
+        for (uint8_t i = 0; i < _count; i++) {
+            const TelemetrySample& s = _samples[i];
+            long value = series == 0 ? (long)s.rpm
+                       : series == 1 ? (long)s.pwm
+                       : series == 2 ? (long)s.rssi
+                       : (long)s.heap;
+            n = snprintf(buf + pos, len - pos, i ? ",%ld" : "%ld", value - prev);
+            if (n < 0 || (size_t)n >= len - pos) return 0;
+            pos += n;
+            prev = value;
+        }
+
+        if (pos + 1 >= len) return 0;
+        buf[pos++] = ']';
+    }
+
+    if (pos + 2 > len) return 0;
+    buf[pos++] = '}';
+    buf[pos] = '\0';
+    return pos;
+}
@@ -0,0 +1,58 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include <time.h>
+#include "config.h"
+
+// Samples per published batch - ESP8266 has limited RAM and MQTT buffer
+#ifdef PLATFORM_ESP8266
+    #define TELEMETRY_BATCH         20
+    #define TELEMETRY_PAYLOAD_SIZE  640
+#else
+    #define TELEMETRY_BATCH         60
+    #define TELEMETRY_PAYLOAD_SIZE  1400
+#endif
+
+struct TelemetrySample {
+    uint32_t heap;      // Free heap (bytes)
+    uint16_t rpm;
+    uint8_t pwm;        // Raw PWM duty (0-255)
+    int8_t rssi;        // dBm
+};
+
+// Opt-in high-resolution telemetry. Samples fan and WiFi metrics every
+// interval seconds and publishes them as delta-encoded batches on the
+// non-retained <base>/telemetry topic, so a time-series database gets
+// second-level resolution at one publish per batch.
+class Telemetry {
+public:
+    void begin(uint8_t intervalSeconds);
+    void loop();
+
+    // Safe to call from any context, takes effect on the next loop()
+    void setInterval(uint8_t seconds);  // 0 = off
+    uint8_t getInterval() const { return _interval; }
+
+    uint32_t getBatchesSent() const { return _batchesSent; }
+    uint32_t getBatchesDropped() const { return _batchesDropped; }
+
+private:
+    TelemetrySample _samples[TELEMETRY_BATCH];
+    uint8_t _count = 0;
+    volatile uint8_t _interval = 0;
+    volatile bool _resetPending = false;
+    unsigned long _lastSample = 0;
+    uint32_t _firstUptime = 0;          // Uptime (s) of the first sample in the batch
+    time_t _firstEpoch = 0;             // Epoch of the first sample (0 = no NTP yet)
+    uint32_t _batchesSent = 0;
+    uint32_t _batchesDropped = 0;       // Not connected, or payload did not fit
+
+    void sample();
+    void publishBatch();
+    size_t render(char* buf, size_t len);
+};
+
+extern Telemetry telemetry;
+
+#endif // TELEMETRY_H
@@ -1,6 +1,8 @@
 #include "update_checker.h"
 #include "config.h"
 #include "logger.h"
+#include "storage.h"
+#include "history.h"
 #include <ArduinoJson.h>
 
 #ifdef PLATFORM_ESP8266
@@ -436,6 +438,8 @@ void UpdateChecker::performOTAUpdate() {
     _info.downloadProgress = 100;
     if (_stateCallback) _stateCallback();
 
+    storage.flush();
+    history.checkpoint();
     delay(1000);
     ESP.restart();
 }
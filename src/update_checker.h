@@ -44,6 +44,9 @@ public:
     uint8_t getDownloadProgress() const { return _info.downloadProgress; }
     unsigned long getLastCheckTime() const { return _info.lastCheckTime; }
 
+    // Semantic version compare: <0, 0 or >0 like strcmp
+    static int compareVersions(const char* v1, const char* v2);
+
     // ESP32 only: Start OTA download from GitHub
     #ifndef PLATFORM_ESP8266
     void startOTAUpdate();
@@ -67,7 +70,6 @@ private:
     // Actual HTTP check (blocking, called from loop)
     void performCheck();
     bool fetchGitHubRelease();
-    int compareVersions(const char* v1, const char* v2);
 
     #ifndef PLATFORM_ESP8266
     bool _otaRequested = false;
@@ -8,8 +8,19 @@
 #include "mqtt_handler.h"
 #include "update_checker.h"
 #include "logger.h"
+#include "telemetry.h"
+#include "history.h"
+#include "json_writer.h"
+#include "state_version.h"
+#include "loop_stats.h"
+#include <memory>
 #include <ArduinoJson.h>
 
+// Gzipped UI in PROGMEM, generated by tools/embed_web.py
+#ifdef WEB_EMBEDDED_UI
+#include "web_assets.h"
+#endif
+
 // RFID support for all platforms with RC522_ENABLED
 #if defined(RC522_ENABLED)
 #include "rfid_handler.h"
@@ -49,6 +60,8 @@ void stopAsyncWebServer() {
 
 WebServer webServer;
 
+volatile uint32_t stateVersion = 0;
+
 void WebServer::begin() {
     if (_server != nullptr) {
         return;
@@ -62,6 +75,13 @@ void WebServer::begin() {
 #endif
         Serial.println("[WEB] Filesystem mount failed");
     }
+#ifdef WEB_EMBEDDED_UI
+    _embeddedUI = !filesystemUINewer();
+    Serial.printf("[WEB] Serving %s UI\n", _embeddedUI ? "embedded" : "filesystem");
+#endif
+    if (!_embeddedUI) hashIndex();
+    stateVersion = random(0x7FFFFFFF);  // See state_version.h
+    _inFlight = 0;
 
     _server = new AsyncWebServer(WEBSERVER_PORT);
     if (_server == nullptr) {
@@ -87,6 +107,8 @@ void WebServer::loop() {
     // Process deferred actions from async callbacks
     // This prevents blocking the network stack in callbacks
 
+    applyFanCommand();
+
     if (_pendingActionTime == 0) return;
 
     // Wait for HTTP response to be sent (500ms is enough for TCP ACK)
@@ -116,12 +138,15 @@ void WebServer::loop() {
         _pendingReset = false;
         actionProcessed = true;
         storage.reset();
+        history.clear();
         ESP.restart();
     }
 
     if (_pendingRestart) {
         _pendingRestart = false;
         actionProcessed = true;
+        storage.flush();
+        history.checkpoint();
         ESP.restart();
     }
 
@@ -149,86 +174,334 @@ void WebServer::onSettingsChanged(SettingsCallback callback) {
     _settingsCallback = callback;
 }
 
+// ETag for index.html - FNV-1a over the stored file, computed once at boot
+// (a filesystem update always ends in a restart)
+void WebServer::hashIndex() {
+    _indexEtag[0] = '\0';
+    File file = FILESYSTEM.open("/index.html.gz", "r");
+    if (!file) file = FILESYSTEM.open("/index.html", "r");
+    if (!file) return;
+
+    uint32_t hash = 2166136261UL;
+    uint8_t buf[64];
+    size_t n;
+    while ((n = file.read(buf, sizeof(buf))) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= buf[i];
+            hash *= 16777619UL;
+        }
+    }
+    file.close();
+    snprintf(_indexEtag, sizeof(_indexEtag), "\"%08lx\"", (unsigned long)hash);
+}
+
+// A UI uploaded with /api/update/filesystem after this firmware was built
+// wins over the embedded copy. data/ui_version.txt is written by
+// tools/build_web.py; older filesystem images without it never win.
+bool WebServer::filesystemUINewer() {
+    File file = FILESYSTEM.open("/ui_version.txt", "r");
+    if (!file) return false;
+
+    char version[16];
+    size_t len = file.readBytes(version, sizeof(version) - 1);
+    file.close();
+    version[len] = '\0';
+    return UpdateChecker::compareVersions(version, FIRMWARE_VERSION) > 0;
+}
+
+#ifdef WEB_EMBEDDED_UI
+// Straight from flash - no file open or read, same headers as the
+// filesystem path
+void WebServer::handleEmbedded(AsyncWebServerRequest* request, const WebAsset& asset) {
+    AsyncWebHeader* match = request->getHeader("If-None-Match");
+    AsyncWebServerResponse* response;
+    if (match && match->value() == asset.etag) {
+        response = request->beginResponse(304);
+    } else {
+        response = request->beginResponse_P(200, asset.contentType, asset.data, asset.length);
+        response->addHeader("Content-Encoding", "gzip");
+    }
+    response->addHeader("Cache-Control", asset.hashed ? WEB_ASSET_CACHE_CONTROL : WEB_INDEX_CACHE_CONTROL);
+    response->addHeader("ETag", asset.etag);
+    request->send(response);
+}
+#endif
+
+// index.html with a short TTL; revalidation costs a bodyless 304
+void WebServer::handleIndex(AsyncWebServerRequest* request) {
+    AsyncWebHeader* match = request->getHeader("If-None-Match");
+    AsyncWebServerResponse* response;
+    if (match && match->value() == _indexEtag) {
+        response = request->beginResponse(304);
+    } else {
+        response = request->beginResponse(FILESYSTEM, "/index.html", "text/html");
+    }
+    response->addHeader("Cache-Control", WEB_INDEX_CACHE_CONTROL);
+    response->addHeader("ETag", _indexEtag);
+    request->send(response);
+}
+
+// Free heap and largest allocatable block - the block is what decides
+// whether the next response buffer (or a TLS handshake) still fits
+static uint32_t maxFreeBlock() {
+#ifdef PLATFORM_ESP8266
+    return ESP.getMaxFreeBlockSize();
+#else
+    return ESP.getMaxAllocHeap();
+#endif
+}
+
+void WebServer::recordRoute(RouteStats& stats, uint32_t us, uint32_t heapBefore, uint32_t blockBefore) {
+    uint32_t heap = ESP.getFreeHeap();
+    uint32_t block = maxFreeBlock();
+
+    stats.count++;
+    stats.totalUs += us;
+    if (us > stats.maxUs) stats.maxUs = us;
+    if (heap < heapBefore) {
+        stats.maxHeapDrop = max(stats.maxHeapDrop, (uint16_t)min(heapBefore - heap, (uint32_t)UINT16_MAX));
+    }
+    if (block < blockBefore) {
+        stats.maxBlockDrop = max(stats.maxBlockDrop, (uint16_t)min(blockBefore - block, (uint32_t)UINT16_MAX));
+    }
+
+    if (WEB_SLOW_REQUEST_MS > 0 && us >= WEB_SLOW_REQUEST_MS * 1000UL) {
+        stats.slow++;
+        Serial.printf("[WEB] Slow request: %s took %lums, heap %lu -> %lu, block %lu -> %lu\n",
+                      stats.uri, (unsigned long)(us / 1000), (unsigned long)heapBefore, (unsigned long)heap,
+                      (unsigned long)blockBefore, (unsigned long)block);
+    }
+}
+
+// Always admitted: fan control must stay responsive, switching to sync OTA
+// frees memory rather than using it, and the browser loads the page shell
+// in parallel without retrying - a 503 there breaks the UI. API GETs from
+// script.js wait out a 503 and retry instead.
+static const char* const CRITICAL_ROUTES[] = {
+    "/api/fan", "/api/ota/prepare",
+    "/", "/index.html", "/update.html", "/style.css", "/script.js", "/favicon.ico"
+};
+
+// First handler in the chain, so it sees every request once its headers are
+// in - before routes, static files and onNotFound. Counts the requests in
+// flight; when over budget it claims non-critical ones and answers with a
+// bare 503, so they never open a file or build a response body.
+class AdmissionHandler : public AsyncWebHandler {
+public:
+    explicit AdmissionHandler(WebServer& server) : _web(server) {}
+
+    bool canHandle(AsyncWebServerRequest* request) override {
+        // Called once per request; the request ends with a disconnect
+        uint8_t inFlight = ++_web._inFlight;
+        if (inFlight > _web._peakInFlight) _web._peakInFlight = inFlight;
+        WebServer* web = &_web;
+        request->onDisconnect([web]() {
+            if (web->_inFlight > 0) web->_inFlight--;
+        });
+
+        for (const char* uri : CRITICAL_ROUTES) {
+            if (request->url() == uri) return false;
+        }
+        if (inFlight <= WEB_MAX_IN_FLIGHT && ESP.getFreeHeap() >= WEB_MIN_FREE_HEAP) {
+            return false;
+        }
+        _web._admissionRejects++;
+        return true;
+    }
+
+    void handleRequest(AsyncWebServerRequest* request) override {
+        AsyncWebServerResponse* response = request->beginResponse(503);
+        response->addHeader("Retry-After", WEB_RETRY_AFTER);
+        request->send(response);
+    }
+
+private:
+    WebServer& _web;
+};
+
+// Wraps a handler with the per-route accounting. Only the handler itself is
+// timed; for uploads that is the final request handler, not the upload.
+ArRequestHandlerFunction WebServer::instrument(const char* uri, WebRequestMethodComposite method,
+                                               ArRequestHandlerFunction handler) {
+    if (_routeCount >= WEB_ROUTE_STATS_MAX) return handler;
+
+    RouteStats* stats = &_routes[_routeCount++];
+    memset(stats, 0, sizeof(RouteStats));
+    stats->uri = uri;
+    stats->method = method;
+
+    return [stats, handler](AsyncWebServerRequest* request) {
+        uint32_t heap = ESP.getFreeHeap();
+        uint32_t block = maxFreeBlock();
+        unsigned long start = micros();
+        handler(request);
+        recordRoute(*stats, micros() - start, heap, block);
+    };
+}
+
+AsyncCallbackWebHandler& WebServer::route(const char* uri, WebRequestMethodComposite method,
+                                          ArRequestHandlerFunction handler,
+                                          ArUploadHandlerFunction upload, ArBodyHandlerFunction body) {
+    return _server->on(uri, method, instrument(uri, method, handler), upload, body);
+}
+
 void WebServer::setupRoutes() {
-    // Serve static files from filesystem
+    _routeCount = 0;
+
+    // Admission control - must stay the first handler
+    _server->addHandler(new AdmissionHandler(*this));
+
+#ifdef WEB_EMBEDDED_UI
+    // UI compiled into the firmware, ahead of the filesystem handlers
+    if (_embeddedUI) {
+        for (const WebAsset& asset : WEB_ASSETS) {
+            route(asset.path, HTTP_GET, [this, &asset](AsyncWebServerRequest* request) {
+                handleEmbedded(request, asset);
+            });
+            if (strcmp(asset.path, "/index.html") == 0) {
+                route("/", HTTP_GET, [this, &asset](AsyncWebServerRequest* request) {
+                    handleEmbedded(request, asset);
+                });
+            }
+        }
+    }
+#endif
+
+    // Serve static files from filesystem. Assets are requested by content
+    // hash, so browsers may keep them forever; handlers match in order.
+    _server->serveStatic("/style.css", FILESYSTEM, "/style.css").setCacheControl(WEB_ASSET_CACHE_CONTROL);
+    _server->serveStatic("/script.js", FILESYSTEM, "/script.js").setCacheControl(WEB_ASSET_CACHE_CONTROL);
+    if (_indexEtag[0]) {
+        route("/", HTTP_GET, [this](AsyncWebServerRequest* request) {
+            handleIndex(request);
+        });
+        route("/index.html", HTTP_GET, [this](AsyncWebServerRequest* request) {
+            handleIndex(request);
+        });
+    }
+    // Missing index.html falls through to onNotFound (captive portal error page)
     _server->serveStatic("/", FILESYSTEM, "/").setDefaultFile("index.html");
 
-    // API endpoints
-    _server->on("/api/status", HTTP_GET, [this](AsyncWebServerRequest* request) {
-        handleStatus(request);
-    });
+    // API endpoints. A route also matches "<uri>/..." and the first match
+    // wins, so sub-paths are registered before their parent.
 
     // Lite status endpoint for polling - uses stack allocation to reduce heap pressure on ESP8266
-    _server->on("/api/status/lite", HTTP_GET, [this](AsyncWebServerRequest* request) {
+    route("/api/status/lite", HTTP_GET, [this](AsyncWebServerRequest* request) {
         handleStatusLite(request);
     });
 
-    _server->on("/api/wifi", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/status", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        handleStatus(request);
+    });
+
+    route("/api/wifi", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleSaveWifi(request);
     });
 
-    _server->on("/api/mqtt", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/mqtt", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleSaveMqtt(request);
     });
 
-    _server->on("/api/fan", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/fan", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleFanControl(request);
     });
 
-    _server->on("/api/reset", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/reset", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleReset(request);
     });
 
-    _server->on("/api/passwords", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/passwords", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleSavePasswords(request);
     });
 
-    _server->on("/api/passwords", HTTP_GET, [this](AsyncWebServerRequest* request) {
+    route("/api/passwords", HTTP_GET, [this](AsyncWebServerRequest* request) {
         handleGetPasswords(request);
     });
 
-    _server->on("/api/night", HTTP_GET, [this](AsyncWebServerRequest* request) {
+    route("/api/night", HTTP_GET, [this](AsyncWebServerRequest* request) {
         handleGetNightMode(request);
     });
 
-    _server->on("/api/night", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/night", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleSaveNightMode(request);
     });
 
+    // Batched settings - the JSON body is collected into _tempObject (freed
+    // with the request) and handled once complete
+    route("/api/settings", HTTP_POST,
+        [this](AsyncWebServerRequest* request) {
+            handleSaveSettings(request);
+        },
+        nullptr,
+        [](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+            if (index == 0 && total <= WEB_SETTINGS_BODY_MAX) {
+                char* body = (char*)malloc(total + 1);
+                if (body) body[total] = '\0';
+                request->_tempObject = body;
+            }
+            if (request->_tempObject && index + len <= total) {
+                memcpy((char*)request->_tempObject + index, data, len);
+            }
+        });
+
     // System logs - stream JSON directly into the response so we never hold the
     // full payload in heap (critical on ESP8266 with limited RAM).
     // Pre-size the stream buffer to one alloc instead of growing under
     // backpressure (default ~1460 bytes; full log JSON can reach ~2.4 KB).
-    _server->on("/api/logs", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/api/logs", HTTP_GET, [](AsyncWebServerRequest* request) {
         AsyncResponseStream* response = request->beginResponseStream("application/json", 4096);
         logger.streamJson(*response);
         request->send(response);
     });
 
-    _server->on("/api/logs", HTTP_DELETE, [](AsyncWebServerRequest* request) {
+    route("/api/logs", HTTP_DELETE, [](AsyncWebServerRequest* request) {
         logger.clear();
         request->send(200, "application/json", "{\"success\":true,\"message\":\"Logs cleared\"}");
     });
 
-    // Hardware diagnostics
-    _server->on("/api/diagnostic", HTTP_GET, [this](AsyncWebServerRequest* request) {
-        handleDiagnostic(request);
+    // Per-minute history, streamed block by block from flash:
+    // ?format=csv (default) or bin (raw blocks, see history.h), ?hours=N
+    route("/api/history", HTTP_GET, [](AsyncWebServerRequest* request) {
+        bool csv = !request->hasParam("format") || request->getParam("format")->value() != "bin";
+        uint16_t hours = request->hasParam("hours") ? constrain(request->getParam("hours")->value().toInt(), 1, 24 * 14) : 24;
+        std::shared_ptr<HistoryReader> reader = std::make_shared<HistoryReader>(csv, hours);
+        AsyncWebServerResponse* response = request->beginChunkedResponse(
+            csv ? "text/csv" : "application/octet-stream",
+            [reader](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+                return reader->read(buffer, maxLen);
+            });
+        response->addHeader("Cache-Control", "no-store");
+        request->send(response);
+    });
+
+    // Prometheus scrape target
+    route("/metrics", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        handleMetrics(request);
     });
 
-    _server->on("/api/diagnostic/led", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    // Hardware diagnostics - sub-paths first, see above
+    route("/api/diagnostic/led", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleDiagnosticLed(request);
     });
 
-    _server->on("/api/diagnostic/fan", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/diagnostic/fan", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleDiagnosticFan(request);
     });
 
-    _server->on("/api/diagnostic/buttons", HTTP_GET, [this](AsyncWebServerRequest* request) {
+    route("/api/diagnostic/buttons", HTTP_GET, [this](AsyncWebServerRequest* request) {
         handleDiagnosticButtons(request);
     });
 
+    route("/api/diagnostic/routes", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        handleDiagnosticRoutes(request);
+    });
+
+    route("/api/diagnostic", HTTP_GET, [this](AsyncWebServerRequest* request) {
+        handleDiagnostic(request);
+    });
+
     // Device settings
-    _server->on("/api/device", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/device", HTTP_POST, [this](AsyncWebServerRequest* request) {
         if (request->hasParam("name", true)) {
             String name = request->getParam("name", true)->value();
             if (name.length() > 0 && name.length() < 32) {
@@ -243,23 +516,23 @@ void WebServer::setupRoutes() {
     });
 
     // Update checker endpoints
-    _server->on("/api/update/check", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/update/check", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleUpdateCheck(request);
     });
 
-    _server->on("/api/update/status", HTTP_GET, [this](AsyncWebServerRequest* request) {
+    route("/api/update/status", HTTP_GET, [this](AsyncWebServerRequest* request) {
         handleUpdateStatus(request);
     });
 
     #ifndef PLATFORM_ESP8266
-    _server->on("/api/update/install", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/update/install", HTTP_POST, [this](AsyncWebServerRequest* request) {
         handleStartUpdate(request);
     });
     #endif
 
     #ifdef PLATFORM_ESP8266
     // ESP8266: Prepare for sync OTA mode (stops async server, starts sync server)
-    _server->on("/api/ota/prepare", HTTP_POST, [this](AsyncWebServerRequest* request) {
+    route("/api/ota/prepare", HTTP_POST, [this](AsyncWebServerRequest* request) {
         Serial.println("[OTA] Preparing for sync OTA mode...");
         Serial.printf("[OTA] Flag BEFORE: %d\n", requestSyncOTAMode ? 1 : 0);
 
@@ -272,7 +545,7 @@ void WebServer::setupRoutes() {
     #endif
 
     // OTA Update - Firmware
-    _server->on("/api/update/firmware", HTTP_POST,
+    route("/api/update/firmware", HTTP_POST,
         [this](AsyncWebServerRequest* request) {
             // Upload complete handler
             bool success = !Update.hasError();
@@ -295,6 +568,8 @@ void WebServer::setupRoutes() {
                 Serial.printf("[OTA] Firmware update start: %s\n", filename.c_str());
                 otaInProgress = true;
                 updateLedStatus();
+                storage.flush();  // Commit deferred settings before flash is rewritten
+                history.checkpoint();
 
                 // Stop non-essential services to free memory
                 mqttHandler.disconnect();
@@ -348,7 +623,7 @@ void WebServer::setupRoutes() {
     );
 
     // OTA Update - Filesystem
-    _server->on("/api/update/filesystem", HTTP_POST,
+    route("/api/update/filesystem", HTTP_POST,
         [this](AsyncWebServerRequest* request) {
             bool success = !Update.hasError();
             AsyncWebServerResponse* response = request->beginResponse(
@@ -369,6 +644,7 @@ void WebServer::setupRoutes() {
                 Serial.printf("[OTA] Filesystem update start: %s\n", filename.c_str());
                 otaInProgress = true;
                 updateLedStatus();
+                storage.flush();  // Commit deferred settings before flash is rewritten
 
                 // Stop non-essential services to free memory
                 mqttHandler.disconnect();
@@ -422,37 +698,37 @@ void WebServer::setupRoutes() {
     static const char PROGMEM captiveSuccess[] = "<html><body>Success</body></html>";
 
     // Android requests /generate_204 - returning 204 signals "no internet" which triggers portal popup
-    _server->on("/generate_204", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/generate_204", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send(204);
     });
     // Some Android variants
-    _server->on("/gen_204", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/gen_204", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send(204);
     });
     // iOS/macOS captive portal detection
-    _server->on("/hotspot-detect.html", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/hotspot-detect.html", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send_P(200, "text/html", captiveSuccess);
     });
-    _server->on("/library/test/success.html", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/library/test/success.html", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send_P(200, "text/html", captiveSuccess);
     });
     // Windows captive portal detection
-    _server->on("/connecttest.txt", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/connecttest.txt", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send(200, "text/plain", F("Microsoft Connect Test"));
     });
-    _server->on("/ncsi.txt", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/ncsi.txt", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send(200, "text/plain", F("Microsoft NCSI"));
     });
     // Firefox captive portal detection
-    _server->on("/canonical.html", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/canonical.html", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send_P(200, "text/html", captiveSuccess);
     });
-    _server->on("/success.txt", HTTP_GET, [](AsyncWebServerRequest* request) {
+    route("/success.txt", HTTP_GET, [](AsyncWebServerRequest* request) {
         request->send(200, "text/plain", F("success"));
     });
 
     // Captive portal redirect - only in AP mode, redirect to config page
-    _server->onNotFound([](AsyncWebServerRequest* request) {
+    _server->onNotFound(instrument("*", HTTP_ANY, [](AsyncWebServerRequest* request) {
         // Only redirect GET requests in AP mode for captive portal
         if (request->method() == HTTP_GET && wifiManager.isAPMode()) {
             // Don't redirect if already requesting root (prevents infinite loop if index.html missing)
@@ -471,7 +747,42 @@ void WebServer::setupRoutes() {
         } else {
             request->send(404);
         }
-    });
+    }));
+}
+
+// Sections of /api/status, selectable with ?fields=wifi,fan,...
+enum StatusSection : uint8_t {
+    STATUS_WIFI   = 1 << 0,
+    STATUS_MQTT   = 1 << 1,
+    STATUS_FAN    = 1 << 2,
+    STATUS_DEVICE = 1 << 3,
+    STATUS_STATS  = 1 << 4,
+    STATUS_NIGHT  = 1 << 5,
+    STATUS_UPDATE = 1 << 6,
+    STATUS_RFID   = 1 << 7,
+    STATUS_ALL    = 0xFF
+};
+
+// Bit order of StatusSection
+static const char* const STATUS_SECTION_NAMES[] = {
+    "wifi", "mqtt", "fan", "device", "stats", "night", "update", "rfid"
+};
+
+// Comma-separated section names to a StatusSection mask; unknown names are ignored
+static uint8_t parseStatusSections(const char* list) {
+    uint8_t sections = 0;
+    while (*list) {
+        const char* end = strchr(list, ',');
+        size_t len = end ? (size_t)(end - list) : strlen(list);
+        for (uint8_t i = 0; i < sizeof(STATUS_SECTION_NAMES) / sizeof(STATUS_SECTION_NAMES[0]); i++) {
+            if (strlen(STATUS_SECTION_NAMES[i]) == len && strncmp(STATUS_SECTION_NAMES[i], list, len) == 0) {
+                sections |= 1 << i;
+            }
+        }
+        if (!end) break;
+        list = end + 1;
+    }
+    return sections;
 }
 
 void WebServer::handleStatus(AsyncWebServerRequest* request) {
@@ -483,132 +794,211 @@ void WebServer::handleStatus(AsyncWebServerRequest* request) {
     }
 #endif
 
+    uint8_t sections = STATUS_ALL;
+    if (request->hasParam("fields")) {
+        sections = parseStatusSections(request->getParam("fields")->value().c_str());
+    }
+
+    // Written straight into the response buffer - no JsonDocument and no
+    // String copy, so the payload is only held once. Sized for the typical
+    // ~1 KB response; long release URLs or error messages just grow it.
+    // Accept: application/msgpack gets the same document as MessagePack.
+    AsyncWebHeader* accept = request->getHeader("Accept");
+    if (accept && accept->value().indexOf("msgpack") >= 0) {
+        JsonWriter sizes;
+        renderStatus(sizes, sections);
+        AsyncResponseStream* response = request->beginResponseStream("application/msgpack", 1024);
+        JsonWriter msgpack(*response, sizes);
+        renderStatus(msgpack, sections);
+        request->send(response);
+        return;
+    }
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json", 1152);
+    JsonWriter json(*response);
+    renderStatus(json, sections);
+    request->send(response);
+}
+
+// Unselected sections are skipped entirely - none of their getters run
+void WebServer::renderStatus(JsonWriter& json, uint8_t sections) {
     const DiffuserSettings& settings = storage.getSettings();  // Use cache, no NVS read
 
-    // Use DynamicJsonDocument to avoid stack overflow on ESP8266 (limited 4KB stack).
-    // ESP32 gets a larger doc because long releaseUrl + errorMessage + lastScent
-    // can occasionally push past 1408; ESP8266 keeps the smaller budget with the
-    // low-heap 503 guard above as a safety net.
-#ifdef PLATFORM_ESP8266
-    DynamicJsonDocument doc(1408);
-#else
-    DynamicJsonDocument doc(1536);
-#endif
+    json.beginObject();
 
     // WiFi status
-    doc["wifi"]["connected"] = wifiManager.isConnected();
-    doc["wifi"]["ap_mode"] = wifiManager.isAPMode();
-    doc["wifi"]["ssid"] = wifiManager.getSSID();
-    doc["wifi"]["ip"] = wifiManager.getIP();
-    doc["wifi"]["rssi"] = wifiManager.getRSSI();
+    if (sections & STATUS_WIFI) {
+        json.beginObject("wifi");
+        json.add("connected", wifiManager.isConnected());
+        json.add("ap_mode", wifiManager.isAPMode());
+        json.add("ssid", wifiManager.getSSIDCStr());
+        json.add("ip", wifiManager.getIPAddress());
+        json.add("rssi", wifiManager.getRSSI());
+        json.endObject();
+    }
 
     // MQTT status
-    doc["mqtt"]["connected"] = mqttHandler.isConnected();
-    doc["mqtt"]["host"] = settings.mqttHost;
-    doc["mqtt"]["port"] = settings.mqttPort;
+    if (sections & STATUS_MQTT) {
+        json.beginObject("mqtt");
+        json.add("connected", mqttHandler.isConnected());
+        json.add("host", settings.mqttHost);
+        json.add("port", settings.mqttPort);
+        json.add("json_state", settings.mqttJsonState);
+        json.add("device_discovery", settings.mqttDeviceDiscovery);
+        json.add("telemetry", settings.telemetryInterval);
+        json.endObject();
+    }
 
     // Fan status
-    doc["fan"]["on"] = fanController.isOn();
-    doc["fan"]["speed"] = fanController.getSpeed();
-    doc["fan"]["rpm"] = fanController.getRPM();
-    doc["fan"]["timer_active"] = fanController.isTimerActive();
-    doc["fan"]["remaining_minutes"] = fanController.getRemainingMinutes();
-    doc["fan"]["interval_mode"] = fanController.isIntervalMode();
-    doc["fan"]["interval_on"] = fanController.getIntervalOnTime();
-    doc["fan"]["interval_off"] = fanController.getIntervalOffTime();
+    if (sections & STATUS_FAN) {
+        json.beginObject("fan");
+        json.add("on", fanController.isOn());
+        json.add("speed", fanController.getSpeed());
+        json.add("rpm", fanController.getRPM());
+        json.add("timer_active", fanController.isTimerActive());
+        json.add("remaining_minutes", fanController.getRemainingMinutes());
+        json.add("interval_mode", fanController.isIntervalMode());
+        json.add("interval_on", fanController.getIntervalOnTime());
+        json.add("interval_off", fanController.getIntervalOffTime());
+        json.endObject();
+    }
 
     // Device info
-    doc["device"]["name"] = settings.deviceName;
-    doc["device"]["mac"] = wifiManager.getMacAddress();
-    doc["device"]["version"] = FIRMWARE_VERSION;
-    #ifdef PLATFORM_ESP8266
-    doc["device"]["platform"] = "ESP8266";
-    #else
-    doc["device"]["platform"] = "ESP32";
-    #endif
+    if (sections & STATUS_DEVICE) {
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        char macStr[18];
+        snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        json.beginObject("device");
+        json.add("name", settings.deviceName);
+        json.add("mac", macStr);
+        json.add("version", FIRMWARE_VERSION);
+        #ifdef PLATFORM_ESP8266
+        json.add("platform", "ESP8266");
+        #else
+        json.add("platform", "ESP32");
+        #endif
+        json.endObject();
+    }
 
     // Statistics
-    doc["stats"]["total_runtime"] = storage.getTotalRuntimeMinutes() / 60.0;  // hours
-    doc["stats"]["session_runtime"] = fanController.getSessionRuntimeMinutes();  // minutes
+    if (sections & STATUS_STATS) {
+        json.beginObject("stats");
+        json.add("total_runtime", storage.getTotalRuntimeMinutes() / 60.0);  // hours
+        json.add("session_runtime", fanController.getSessionRuntimeMinutes());  // minutes
+        json.endObject();
+    }
 
     // Night mode
-    doc["night"]["enabled"] = settings.nightModeEnabled;
-    doc["night"]["start"] = settings.nightModeStart;
-    doc["night"]["end"] = settings.nightModeEnd;
-    doc["night"]["brightness"] = settings.nightModeBrightness;
+    if (sections & STATUS_NIGHT) {
+        json.beginObject("night");
+        json.add("enabled", settings.nightModeEnabled);
+        json.add("start", settings.nightModeStart);
+        json.add("end", settings.nightModeEnd);
+        json.add("brightness", settings.nightModeBrightness);
+        json.endObject();
+    }
 
     // Update info
-    doc["update"]["available"] = updateChecker.isUpdateAvailable();
-    doc["update"]["current"] = updateChecker.getCurrentVersion();
-    doc["update"]["latest"] = updateChecker.getLatestVersion();
-    doc["update"]["release_url"] = updateChecker.getReleaseUrl();
-    doc["update"]["state"] = (int)updateChecker.getState();
-    doc["update"]["progress"] = updateChecker.getDownloadProgress();
-    doc["update"]["error"] = updateChecker.getErrorMessage();
-    #ifndef PLATFORM_ESP8266
-    doc["update"]["can_auto_update"] = true;
-    #else
-    doc["update"]["can_auto_update"] = false;
-    #endif
+    if (sections & STATUS_UPDATE) {
+        json.beginObject("update");
+        json.add("available", updateChecker.isUpdateAvailable());
+        json.add("current", updateChecker.getCurrentVersion());
+        json.add("latest", updateChecker.getLatestVersion());
+        json.add("release_url", updateChecker.getReleaseUrl());
+        json.add("state", (int)updateChecker.getState());
+        json.add("progress", updateChecker.getDownloadProgress());
+        json.add("error", updateChecker.getErrorMessage());
+        #ifndef PLATFORM_ESP8266
+        json.add("can_auto_update", true);
+        #else
+        json.add("can_auto_update", false);
+        #endif
+        json.endObject();
+    }
 
     // RFID status
     #if defined(RC522_ENABLED)
-    doc["rfid"]["connected"] = rfidIsConnected();
-    doc["rfid"]["has_tag"] = rfidHasTag();
-    doc["rfid"]["cartridge_present"] = rfidIsCartridgePresent();  // Is cartridge NOW present?
-    doc["rfid"]["last_uid"] = rfidGetLastUID();
-    doc["rfid"]["last_scent"] = rfidGetLastScent();
-    #ifndef PLATFORM_ESP8266
-    doc["rfid"]["last_scent_code"] = rfidGetLastScentCode();
-    #endif
-    doc["rfid"]["time_since_tag"] = rfidTimeSinceLastTag();
-    // Debug info: version register (0x91/0x92/0x88 = valid, 0x00/0xFF = no communication)
-    char versionHex[5];
-    snprintf(versionHex, sizeof(versionHex), "0x%02X", rfidGetVersionReg());
-    doc["rfid"]["version_reg"] = versionHex;
-    #endif
-
-    String response;
-    size_t jsonSize = serializeJson(doc, response);
-    if (jsonSize == 0) {
-        request->send(500, "application/json", "{\"error\":\"JSON serialization failed\"}");
-        return;
+    if (sections & STATUS_RFID) {
+        json.beginObject("rfid");
+        json.add("connected", rfidIsConnected());
+        json.add("has_tag", rfidHasTag());
+        json.add("cartridge_present", rfidIsCartridgePresent());  // Is cartridge NOW present?
+        json.add("last_uid", rfidGetLastUIDCStr());
+        json.add("last_scent", rfidGetLastScentCStr());
+        #ifndef PLATFORM_ESP8266
+        json.add("last_scent_code", rfidGetLastScentCode());
+        #endif
+        json.add("time_since_tag", rfidTimeSinceLastTag());
+        // Debug info: version register (0x91/0x92/0x88 = valid, 0x00/0xFF = no communication)
+        char versionHex[5];
+        snprintf(versionHex, sizeof(versionHex), "0x%02X", rfidGetVersionReg());
+        json.add("version_reg", versionHex);
+        json.endObject();
     }
+    #endif
 
-    request->send(200, "application/json", response);
+    json.endObject();
 }
 
 void WebServer::handleStatusLite(AsyncWebServerRequest* request) {
-    // Lite status endpoint for frequent polling - uses StaticJsonDocument on STACK
-    // to avoid heap allocation and fragmentation on ESP8266
+    // Lite status endpoint for frequent polling - streamed into a small
+    // pre-sized response buffer, no JsonDocument or String copies
     // Contains only data needed for UI polling updates
-    StaticJsonDocument<384> doc;
+
+    // Nothing changed since the client's copy - answer without touching any
+    // state. Read the version first: a change while rendering below then
+    // shows up on the next poll instead of being lost.
+    char etag[12];
+    snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)stateVersion);
+    AsyncWebHeader* match = request->getHeader("If-None-Match");
+    if (match && match->value() == etag) {
+        AsyncWebServerResponse* notModified = request->beginResponse(304);
+        notModified->addHeader("ETag", etag);
+        notModified->addHeader("Cache-Control", "no-cache");
+        request->send(notModified);
+        return;
+    }
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json", 320);
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+    JsonWriter json(*response);
+    json.beginObject();
 
     // Fan status (essential for UI updates)
-    doc["fan"]["on"] = fanController.isOn();
-    doc["fan"]["speed"] = fanController.getSpeed();
-    doc["fan"]["rpm"] = fanController.getRPM();
-    doc["fan"]["timer_active"] = fanController.isTimerActive();
-    doc["fan"]["remaining_minutes"] = fanController.getRemainingMinutes();
-    doc["fan"]["interval_mode"] = fanController.isIntervalMode();
-    doc["fan"]["interval_on"] = fanController.getIntervalOnTime();
-    doc["fan"]["interval_off"] = fanController.getIntervalOffTime();
+    json.beginObject("fan");
+    json.add("on", fanController.isOn());
+    json.add("speed", fanController.getSpeed());
+    json.add("rpm", fanController.getRPM());
+    json.add("timer_active", fanController.isTimerActive());
+    json.add("remaining_minutes", fanController.getRemainingMinutes());
+    json.add("interval_mode", fanController.isIntervalMode());
+    json.add("interval_on", fanController.getIntervalOnTime());
+    json.add("interval_off", fanController.getIntervalOffTime());
+    json.endObject();
 
     // Connectivity status (for status dots)
-    doc["wifi"]["connected"] = wifiManager.isConnected();
-    doc["wifi"]["ap_mode"] = wifiManager.isAPMode();
-    doc["mqtt"]["connected"] = mqttHandler.isConnected();
+    json.beginObject("wifi");
+    json.add("connected", wifiManager.isConnected());
+    json.add("ap_mode", wifiManager.isAPMode());
+    json.endObject();
+    json.beginObject("mqtt");
+    json.add("connected", mqttHandler.isConnected());
+    json.endObject();
 
     // RFID status (only if enabled)
     #if defined(RC522_ENABLED)
-    doc["rfid"]["connected"] = rfidIsConnected();
-    doc["rfid"]["cartridge_present"] = rfidIsCartridgePresent();
-    doc["rfid"]["last_scent"] = rfidGetLastScent();
+    json.beginObject("rfid");
+    json.add("connected", rfidIsConnected());
+    json.add("cartridge_present", rfidIsCartridgePresent());
+    json.add("last_scent", rfidGetLastScentCStr());
+    json.endObject();
     #endif
 
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    json.endObject();
+    request->send(response);
 }
 
 void WebServer::handleSaveWifi(AsyncWebServerRequest* request) {
@@ -688,6 +1078,18 @@ void WebServer::handleSaveMqtt(AsyncWebServerRequest* request) {
     }
 
     storage.setMQTT(host.c_str(), port, userStr.c_str(), passwordStr.c_str());
+    if (request->hasParam("json_state", true)) {
+        storage.setMqttJsonState(request->getParam("json_state", true)->value() == "1");
+    }
+    if (request->hasParam("device_discovery", true)) {
+        storage.setMqttDeviceDiscovery(request->getParam("device_discovery", true)->value() == "1");
+    }
+    if (request->hasParam("telemetry", true)) {
+        int interval = request->getParam("telemetry", true)->value().toInt();
+        interval = constrain(interval, 0, TELEMETRY_INTERVAL_MAX);
+        storage.setTelemetryInterval(interval);
+        telemetry.setInterval(interval);
+    }
 
     request->send(200, "application/json", "{\"success\":true,\"message\":\"MQTT saved, connecting...\"}");
 
@@ -701,108 +1103,191 @@ void WebServer::handleSaveMqtt(AsyncWebServerRequest* request) {
     _pendingActionTime = millis();
 }
 
+// Non-empty and digits only
+static bool isNumber(const String& value) {
+    if (value.length() == 0) return false;
+    for (unsigned int i = 0; i < value.length(); i++) {
+        if (!isDigit(value[i])) return false;
+    }
+    return true;
+}
+
+// _fanCommand is written by the async_tcp task and copied out by loop().
+// On dual-core ESP32 those run on different cores and noInterrupts() only
+// masks the calling core, so the slot needs a spinlock there.
+#ifndef PLATFORM_ESP8266
+static portMUX_TYPE fanCommandMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+static inline void lockFanCommand() {
+#ifdef PLATFORM_ESP8266
+    noInterrupts();
+#else
+    portENTER_CRITICAL(&fanCommandMux);
+#endif
+}
+
+static inline void unlockFanCommand() {
+#ifdef PLATFORM_ESP8266
+    interrupts();
+#else
+    portEXIT_CRITICAL(&fanCommandMux);
+#endif
+}
+
+// Fan commands are acknowledged right away and merged into _fanCommand;
+// loop() applies the latest values once per WEB_FAN_COMMAND_TICK_MS, so a
+// slider drag costs PWM writes, LED updates and MQTT publishes at the tick
+// rate instead of once per POST. The response shows the state the fan will
+// have once the command is applied.
 void WebServer::handleFanControl(AsyncWebServerRequest* request) {
-    StaticJsonDocument<256> response;
-    response["success"] = true;
+    FanCommand command = {};
 
     if (request->hasParam("power", true)) {
         String power = request->getParam("power", true)->value();
-        if (power == "on") {
-            fanController.turnOn();
-        } else if (power == "off") {
-            fanController.turnOff();
+        if (power == "on" || power == "off") {
+            command.fields |= FAN_CMD_POWER;
+            command.power = power == "on";
         }
         // Ignore invalid power values silently (backwards compatible)
     }
 
     if (request->hasParam("speed", true)) {
         const String& speedStr = request->getParam("speed", true)->value();
-        // Validate: must be numeric and 0-100
-        bool validSpeed = true;
-        for (unsigned int i = 0; i < speedStr.length(); i++) {
-            if (!isDigit(speedStr[i])) {
-                validSpeed = false;
-                break;
-            }
-        }
-        if (validSpeed && speedStr.length() > 0) {
-            int speed = speedStr.toInt();
-            if (speed >= 0 && speed <= 100) {
-                fanController.setSpeed(speed);
-                storage.setFanSpeed(speed);
-            }
+        if (isNumber(speedStr) && speedStr.toInt() <= 100) {
+            command.fields |= FAN_CMD_SPEED;
+            command.speed = speedStr.toInt();
         }
         // Ignore invalid speed values silently (backwards compatible)
     }
 
     if (request->hasParam("timer", true)) {
         const String& timerStr = request->getParam("timer", true)->value();
-        // Validate: must be numeric
-        bool validTimer = true;
-        for (unsigned int i = 0; i < timerStr.length(); i++) {
-            if (!isDigit(timerStr[i])) {
-                validTimer = false;
-                break;
-            }
+        if (isNumber(timerStr) && timerStr.toInt() <= 1440) {  // Max 24 hours, 0 = cancel
+            command.fields |= FAN_CMD_TIMER;
+            command.timer = timerStr.toInt();
         }
-        if (validTimer && timerStr.length() > 0) {
-            int timer = timerStr.toInt();
-            if (timer > 0 && timer <= 1440) {  // Max 24 hours
-                fanController.setTimer(timer);
-            } else if (timer == 0) {
-                fanController.cancelTimer();
-            }
-        }
-        updateLedStatus();
     }
 
     if (request->hasParam("interval", true)) {
-        bool interval = request->getParam("interval", true)->value() == "true";
-        fanController.setIntervalMode(interval);
-        // Save interval state immediately
-        storage.setIntervalMode(interval, fanController.getIntervalOnTime(), fanController.getIntervalOffTime());
-        updateLedStatus();
+        command.fields |= FAN_CMD_INTERVAL;
+        command.interval = request->getParam("interval", true)->value() == "true";
     }
 
     if (request->hasParam("interval_on", true) && request->hasParam("interval_off", true)) {
         const String& onStr = request->getParam("interval_on", true)->value();
         const String& offStr = request->getParam("interval_off", true)->value();
-        // Validate: must be numeric
-        bool validOn = onStr.length() > 0;
-        bool validOff = offStr.length() > 0;
-        for (unsigned int i = 0; i < onStr.length() && validOn; i++) {
-            if (!isDigit(onStr[i])) validOn = false;
+        if (isNumber(onStr) && isNumber(offStr)) {
+            // Clamp here - the uint8_t slot would truncate out-of-range input
+            command.fields |= FAN_CMD_INTERVAL_TIMES;
+            command.intervalOn = constrain(onStr.toInt(), INTERVAL_MIN, INTERVAL_MAX);
+            command.intervalOff = constrain(offStr.toInt(), INTERVAL_MIN, INTERVAL_MAX);
         }
-        for (unsigned int i = 0; i < offStr.length() && validOff; i++) {
-            if (!isDigit(offStr[i])) validOff = false;
+    }
+
+    command = postFanCommand(command);
+
+    // Expected state, in the order applyFanCommand() applies the fields
+    bool on = (command.fields & FAN_CMD_POWER) ? command.power : fanController.isOn();
+    uint8_t speed = (command.fields & FAN_CMD_SPEED) ? command.speed : fanController.getSpeed();
+    if ((command.fields & FAN_CMD_SPEED) && speed == 0) on = false;
+    bool timerActive = on && fanController.isTimerActive();
+    uint16_t remaining = timerActive ? fanController.getRemainingMinutes() : 0;
+    if (command.fields & FAN_CMD_TIMER) {
+        timerActive = command.timer > 0;
+        remaining = command.timer;
+        if (timerActive) on = true;
+    }
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    JsonWriter json(*response);
+    json.beginObject();
+    json.add("success", true);
+    json.beginObject("fan");
+    json.add("on", on);
+    json.add("speed", speed);
+    json.add("timer_active", timerActive);
+    json.add("remaining_minutes", remaining);
+    json.endObject();
+    json.endObject();
+    request->send(response);
+}
+
+// Merges a command into the slot for loop() and returns the merged slot.
+// Latest wins per field. Turning off also drops a timer that is still
+// pending, since starting the timer would switch the fan back on.
+WebServer::FanCommand WebServer::postFanCommand(const FanCommand& command) {
+    lockFanCommand();
+    FanCommand& slot = _fanCommand;
+    if ((command.fields & FAN_CMD_POWER) && !command.power) slot.fields &= ~FAN_CMD_TIMER;
+    if (command.fields & FAN_CMD_POWER)          slot.power = command.power;
+    if (command.fields & FAN_CMD_SPEED)          slot.speed = command.speed;
+    if (command.fields & FAN_CMD_TIMER)          slot.timer = command.timer;
+    if (command.fields & FAN_CMD_INTERVAL)       slot.interval = command.interval;
+    if (command.fields & FAN_CMD_INTERVAL_TIMES) {
+        slot.intervalOn = command.intervalOn;
+        slot.intervalOff = command.intervalOff;
+    }
+    slot.fields |= command.fields;
+    FanCommand merged = slot;
+    _fanCommandsReceived++;
+    unlockFanCommand();
+    return merged;
+}
+
+// Applies the merged /api/fan and /api/settings fan commands, called from loop()
+void WebServer::applyFanCommand() {
+    // Unlocked peek at one byte; a command that races it is seen next loop
+    if (_fanCommand.fields == 0) return;
+    if (millis() - _lastFanCommand < WEB_FAN_COMMAND_TICK_MS) return;
+    _lastFanCommand = millis();
+
+    // Copy and clear under one lock, so a merge can't land in between
+    lockFanCommand();
+    FanCommand command = _fanCommand;
+    _fanCommand.fields = 0;
+    unlockFanCommand();
+
+    if (command.fields & FAN_CMD_POWER) {
+        if (command.power) {
+            fanController.turnOn();
+        } else {
+            fanController.turnOff();
         }
-        if (validOn && validOff) {
-            int onTime = onStr.toInt();
-            int offTime = offStr.toInt();
-            // FanController::setIntervalTimes already constrains to INTERVAL_MIN/MAX.
-            // Read the clamped values back so out-of-range input doesn't get truncated
-            // to garbage by the implicit int -> uint8_t cast on Storage::setIntervalMode.
-            fanController.setIntervalTimes(onTime, offTime);
-            storage.setIntervalMode(fanController.isIntervalMode(),
-                                    fanController.getIntervalOnTime(),
-                                    fanController.getIntervalOffTime());
+    }
+
+    if (command.fields & FAN_CMD_SPEED) {
+        fanController.setSpeed(command.speed);
+        storage.setFanSpeed(command.speed);
+    }
+
+    if (command.fields & FAN_CMD_TIMER) {
+        if (command.timer > 0) {
+            fanController.setTimer(command.timer);
+        } else {
+            fanController.cancelTimer();
         }
     }
 
-    // Return current state
-    response["fan"]["on"] = fanController.isOn();
-    response["fan"]["speed"] = fanController.getSpeed();
-    response["fan"]["timer_active"] = fanController.isTimerActive();
-    response["fan"]["remaining_minutes"] = fanController.getRemainingMinutes();
+    if (command.fields & FAN_CMD_INTERVAL) {
+        fanController.setIntervalMode(command.interval);
+    }
 
-    String output;
-    if (serializeJson(response, output) == 0) {
-        request->send(500, "application/json", "{\"error\":\"JSON serialization failed\"}");
-        return;
+    if (command.fields & FAN_CMD_INTERVAL_TIMES) {
+        fanController.setIntervalTimes(command.intervalOn, command.intervalOff);
+    }
+
+    if (command.fields & (FAN_CMD_INTERVAL | FAN_CMD_INTERVAL_TIMES)) {
+        storage.setIntervalMode(fanController.isIntervalMode(),
+                                fanController.getIntervalOnTime(),
+                                fanController.getIntervalOffTime());
+    }
+
+    if (command.fields & (FAN_CMD_TIMER | FAN_CMD_INTERVAL)) {
+        updateLedStatus();
     }
-    request->send(200, "application/json", output);
 
-    // Request MQTT state publish (non-blocking)
+    _fanCommandsApplied++;
     mqttHandler.requestStatePublish();
 }
 
@@ -910,54 +1395,444 @@ void WebServer::handleSaveNightMode(AsyncWebServerRequest* request) {
     request->send(200, "application/json", "{\"success\":true,\"message\":\"Night mode settings saved\"}");
 }
 
+// Optional string member of minLen..maxLen characters, missing keeps value
+static bool settingsString(JsonObject section, const char* key, size_t minLen, size_t maxLen, const char*& value) {
+    JsonVariant v = section[key];
+    if (v.isNull()) return true;
+    if (!v.is<const char*>()) return false;
+    size_t len = strlen(v.as<const char*>());
+    if (len < minLen || len > maxLen) return false;
+    value = v.as<const char*>();
+    return true;
+}
+
+// Optional integer member in min..max, missing keeps value
+static bool settingsInt(JsonObject section, const char* key, long min, long max, long& value) {
+    JsonVariant v = section[key];
+    if (v.isNull()) return true;
+    if (!v.is<long>() || v.as<long>() < min || v.as<long>() > max) return false;
+    value = v.as<long>();
+    return true;
+}
+
+// Optional boolean member, missing keeps value
+static bool settingsBool(JsonObject section, const char* key, bool& value) {
+    JsonVariant v = section[key];
+    if (v.isNull()) return true;
+    if (!v.is<bool>()) return false;
+    value = v.as<bool>();
+    return true;
+}
+
+// Any subset of the individual settings endpoints in one JSON document:
+//   {"wifi":      {"ssid", "password"},
+//    "mqtt":      {"host", "port", "user", "password", "json_state", "device_discovery", "telemetry"},
+//    "device":    {"name"},
+//    "night":     {"enabled", "start", "end", "brightness"},
+//    "passwords": {"ota", "ap"},
+//    "fan":       {"speed", "interval", "interval_on", "interval_off"}}
+// Members missing from a section keep their current value (except the
+// WiFi password, which is empty for an open network). The whole document
+// is validated before anything changes, then applied with one storage
+// commit and one round of deferred reconnects. Fan values go through the
+// /api/fan command slot and are applied (and stored) by loop().
+void WebServer::handleSaveSettings(AsyncWebServerRequest* request) {
+    char* body = (char*)request->_tempObject;
+    if (!body) {
+        if (request->contentLength() > WEB_SETTINGS_BODY_MAX) {
+            request->send(413, "application/json", "{\"error\":\"Settings document too large\"}");
+        } else {
+            request->send(400, "application/json", "{\"error\":\"Missing JSON body\"}");
+        }
+        return;
+    }
+
+    // Parses in place - strings point into the body buffer
+    DynamicJsonDocument doc(WEB_SETTINGS_BODY_MAX);
+    DeserializationError err = deserializeJson(doc, body);
+    if (err || !doc.is<JsonObject>()) {
+        request->send(400, "application/json", "{\"error\":\"Invalid JSON document\"}");
+        return;
+    }
+
+    JsonObject wifi, mqtt, device, night, passwords, fan;
+    for (JsonPair section : doc.as<JsonObject>()) {
+        const char* key = section.key().c_str();
+        JsonObject value = section.value().as<JsonObject>();
+        if (value.isNull()) {
+            request->send(400, "application/json", "{\"error\":\"Settings sections must be objects\"}");
+            return;
+        }
+        if (strcmp(key, "wifi") == 0)            wifi = value;
+        else if (strcmp(key, "mqtt") == 0)       mqtt = value;
+        else if (strcmp(key, "device") == 0)     device = value;
+        else if (strcmp(key, "night") == 0)      night = value;
+        else if (strcmp(key, "passwords") == 0)  passwords = value;
+        else if (strcmp(key, "fan") == 0)        fan = value;
+        else {
+            request->send(400, "application/json", "{\"error\":\"Unknown settings section\"}");
+            return;
+        }
+    }
+
+    // Validate everything first - nothing is stored unless the whole document is valid
+    const DiffuserSettings& current = storage.getSettings();
+    const char* error = nullptr;
+
+    const char* ssid = nullptr;
+    const char* wifiPassword = "";
+    if (!wifi.isNull()) {
+        if (!settingsString(wifi, "ssid", 1, 32, ssid) || !ssid) {
+            error = "wifi.ssid must be 1-32 characters";
+        } else if (!settingsString(wifi, "password", 0, 63, wifiPassword) ||
+                   (wifiPassword[0] && strlen(wifiPassword) < 8)) {
+            error = "wifi.password must be 8-63 characters (or empty for open network)";
+        }
+    }
+
+    const char* mqttHost = current.mqttHost;
+    long mqttPort = current.mqttPort;
+    const char* mqttUser = current.mqttUser;
+    const char* mqttPassword = current.mqttPassword;
+    bool jsonState = current.mqttJsonState;
+    bool deviceDiscovery = current.mqttDeviceDiscovery;
+    long telemetryInterval = current.telemetryInterval;
+    if (!error && !mqtt.isNull()) {
+        if (!settingsString(mqtt, "host", 1, sizeof(current.mqttHost) - 1, mqttHost) || !mqttHost[0]) {
+            error = "mqtt.host must be 1-63 characters";
+        } else if (!settingsInt(mqtt, "port", 1, 65535, mqttPort)) {
+            error = "mqtt.port must be 1-65535";
+        } else if (!settingsString(mqtt, "user", 0, sizeof(current.mqttUser) - 1, mqttUser)) {
+            error = "mqtt.user must be max 31 characters";
+        } else if (!settingsString(mqtt, "password", 0, sizeof(current.mqttPassword) - 1, mqttPassword)) {
+            error = "mqtt.password must be max 63 characters";
+        } else if (!settingsBool(mqtt, "json_state", jsonState)) {
+            error = "mqtt.json_state must be true or false";
+        } else if (!settingsBool(mqtt, "device_discovery", deviceDiscovery)) {
+            error = "mqtt.device_discovery must be true or false";
+        } else if (!settingsInt(mqtt, "telemetry", 0, TELEMETRY_INTERVAL_MAX, telemetryInterval)) {
+            error = "mqtt.telemetry out of range";
+        }
+    }
+
+    const char* deviceName = nullptr;
+    if (!error && !device.isNull()) {
+        if (!settingsString(device, "name", 1, sizeof(current.deviceName) - 1, deviceName) || !deviceName) {
+            error = "device.name must be 1-31 characters";
+        }
+    }
+
+    bool nightEnabled = current.nightModeEnabled;
+    long nightStart = current.nightModeStart;
+    long nightEnd = current.nightModeEnd;
+    long nightBrightness = current.nightModeBrightness;
+    if (!error && !night.isNull()) {
+        if (!settingsBool(night, "enabled", nightEnabled)) {
+            error = "night.enabled must be true or false";
+        } else if (!settingsInt(night, "start", 0, 23, nightStart) || !settingsInt(night, "end", 0, 23, nightEnd)) {
+            error = "night.start and night.end must be 0-23";
+        } else if (!settingsInt(night, "brightness", 0, 100, nightBrightness)) {
+            error = "night.brightness must be 0-100";
+        }
+    }
+
+    const char* otaPassword = nullptr;
+    const char* apPassword = nullptr;
+    if (!error && !passwords.isNull()) {
+        if (!settingsString(passwords, "ota", 8, sizeof(current.otaPassword) - 1, otaPassword)) {
+            error = "passwords.ota must be 8-31 characters";
+        } else if (!settingsString(passwords, "ap", 8, sizeof(current.apPassword) - 1, apPassword)) {
+            error = "passwords.ap must be 8-31 characters";
+        }
+    }
+
+    long fanSpeed = fanController.getSpeed();
+    bool intervalMode = fanController.isIntervalMode();
+    long intervalOn = fanController.getIntervalOnTime();
+    long intervalOff = fanController.getIntervalOffTime();
+    if (!error && !fan.isNull()) {
+        if (!settingsInt(fan, "speed", 0, 100, fanSpeed)) {
+            error = "fan.speed must be 0-100";
+        } else if (!settingsBool(fan, "interval", intervalMode)) {
+            error = "fan.interval must be true or false";
+        } else if (!settingsInt(fan, "interval_on", INTERVAL_MIN, INTERVAL_MAX, intervalOn) ||
+                   !settingsInt(fan, "interval_off", INTERVAL_MIN, INTERVAL_MAX, intervalOff)) {
+            error = "fan.interval_on and fan.interval_off out of range";
+        }
+    }
+
+    if (error) {
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        response->setCode(400);
+        JsonWriter json(*response);
+        json.beginObject();
+        json.add("error", error);
+        json.endObject();
+        request->send(response);
+        return;
+    }
+
+    // Deferred reconnects, as /api/wifi and /api/mqtt do. Copied first:
+    // unchanged MQTT fields still point into the settings being rewritten.
+    if (!wifi.isNull()) {
+        strlcpy(_pendingWifiSsid, ssid, sizeof(_pendingWifiSsid));
+        strlcpy(_pendingWifiPassword, wifiPassword, sizeof(_pendingWifiPassword));
+        _pendingWifiConnect = true;
+    }
+    if (!mqtt.isNull()) {
+        strlcpy(_pendingMqttHost, mqttHost, sizeof(_pendingMqttHost));
+        _pendingMqttPort = mqttPort;
+        strlcpy(_pendingMqttUser, mqttUser, sizeof(_pendingMqttUser));
+        strlcpy(_pendingMqttPassword, mqttPassword, sizeof(_pendingMqttPassword));
+        _pendingMqttConnect = true;
+    }
+
+    // Apply - setters that normally commit on their own are held back
+    // until endBatch(), so the whole document costs one flash write
+    storage.beginBatch();
+    if (!wifi.isNull()) {
+        storage.setWiFi(_pendingWifiSsid, _pendingWifiPassword);
+    }
+    if (!mqtt.isNull()) {
+        storage.setMQTT(_pendingMqttHost, _pendingMqttPort, _pendingMqttUser, _pendingMqttPassword);
+        storage.setMqttJsonState(jsonState);
+        storage.setMqttDeviceDiscovery(deviceDiscovery);
+        storage.setTelemetryInterval(telemetryInterval);
+        telemetry.setInterval(telemetryInterval);
+    }
+    if (!device.isNull()) {
+        storage.setDeviceName(deviceName);
+    }
+    if (!night.isNull()) {
+        storage.setNightMode(nightEnabled, nightStart, nightEnd, nightBrightness);
+    }
+    if (otaPassword) storage.setOTAPassword(otaPassword);
+    if (apPassword) storage.setAPPassword(apPassword);
+    storage.endBatch();
+
+    // The fan is only touched from loop(), like /api/fan; applyFanCommand()
+    // also stores the values and publishes the state
+    if (!fan.isNull()) {
+        FanCommand command = {};
+        command.fields = FAN_CMD_SPEED | FAN_CMD_INTERVAL | FAN_CMD_INTERVAL_TIMES;
+        command.speed = fanSpeed;
+        command.interval = intervalMode;
+        command.intervalOn = intervalOn;
+        command.intervalOff = intervalOff;
+        postFanCommand(command);
+    }
+
+    if (!night.isNull()) checkNightMode(true);
+
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    JsonWriter json(*response);
+    json.beginObject();
+    json.add("success", true);
+    json.add("message", wifi.isNull() && mqtt.isNull() ? "Settings saved" : "Settings saved, connecting...");
+    json.add("restart_required", otaPassword || apPassword);
+    json.endObject();
+    request->send(response);
+
+    if (!wifi.isNull() || !mqtt.isNull()) {
+        _pendingActionTime = millis();
+    }
+}
+
 // =====================================================
 // Hardware Diagnostics
 // =====================================================
 
 void WebServer::handleDiagnostic(AsyncWebServerRequest* request) {
-    // Use StaticJsonDocument on stack to avoid heap allocation and fragmentation
-    // ESP8266 has 4KB stack which can handle 384 bytes
-    StaticJsonDocument<384> doc;
+    // Streamed - the ESP32 per-key NVS counters no longer need a bigger
+    // document, the buffer simply grows
+#ifdef PLATFORM_ESP8266
+    AsyncResponseStream* response = request->beginResponseStream("application/json", 896);
+#else
+    AsyncResponseStream* response = request->beginResponseStream("application/json", 1408);
+#endif
+    JsonWriter json(*response);
+    json.beginObject();
 
     // Fan status - connected if we detect RPM when running
     uint16_t rpm = fanController.getRPM();
     bool fanConnected = (fanController.isOn() && rpm > 0) || !fanController.isOn();
-    doc["fan"]["connected"] = fanConnected;
-    doc["fan"]["on"] = fanController.isOn();
-    doc["fan"]["speed"] = fanController.getSpeed();
-    doc["fan"]["rpm"] = rpm;
-    doc["fan"]["pwm"] = fanController.getCurrentPWMValue();
-    doc["fan"]["invert"] = fanController.isInvertPWM();
-    doc["fan"]["min_pwm"] = fanController.getMinPWM();
-    doc["fan"]["calibrating"] = fanController.isCalibrating();
+    json.beginObject("fan");
+    json.add("connected", fanConnected);
+    json.add("on", fanController.isOn());
+    json.add("speed", fanController.getSpeed());
+    json.add("rpm", rpm);
+    json.add("pwm", fanController.getCurrentPWMValue());
+    json.add("invert", fanController.isInvertPWM());
+    json.add("min_pwm", fanController.getMinPWM());
+    json.add("calibrating", fanController.isCalibrating());
+    json.endObject();
 
     // LED status
-    doc["led"]["connected"] = true;  // Cannot detect, assume connected
-    doc["led"]["mode"] = (int)ledController.getMode();
-    doc["led"]["brightness"] = ledController.getBrightness();
+    json.beginObject("led");
+    json.add("connected", true);  // Cannot detect, assume connected
+    json.add("mode", (int)ledController.getMode());
+    json.add("brightness", ledController.getBrightness());
+    json.endObject();
 
     // Button status
-    doc["buttons"]["front_pressed"] = buttonHandler.isFrontPressed();
-    doc["buttons"]["rear_pressed"] = buttonHandler.isRearPressed();
+    json.beginObject("buttons");
+    json.add("front_pressed", buttonHandler.isFrontPressed());
+    json.add("rear_pressed", buttonHandler.isRearPressed());
+    json.endObject();
 
     // Pin configuration
+    json.beginObject("pins");
 #ifdef PLATFORM_ESP8266
-    doc["pins"]["platform"] = "ESP8266";
+    json.add("platform", "ESP8266");
 #else
-    doc["pins"]["platform"] = "ESP32";
+    json.add("platform", "ESP32");
 #endif
-    doc["pins"]["fan_pwm"] = FAN_PWM_PIN;
-    doc["pins"]["fan_tacho"] = FAN_TACHO_PIN;
-    doc["pins"]["led"] = LED_DATA_PIN;
-    doc["pins"]["btn_front"] = BUTTON_FRONT_PIN;
-    doc["pins"]["btn_rear"] = BUTTON_REAR_PIN;
-
-    String response;
-    if (serializeJson(doc, response) == 0) {
-        request->send(500, "application/json", "{\"error\":\"JSON serialization failed\"}");
-        return;
+    json.add("fan_pwm", FAN_PWM_PIN);
+    json.add("fan_tacho", FAN_TACHO_PIN);
+    json.add("led", LED_DATA_PIN);
+    json.add("btn_front", BUTTON_FRONT_PIN);
+    json.add("btn_rear", BUTTON_REAR_PIN);
+    json.endObject();
+
+    // MQTT connection
+    json.beginObject("mqtt");
+    json.add("connected", mqttHandler.isConnected());
+    json.add("attempts", mqttHandler.getConnectAttempts());
+    json.add("failures", mqttHandler.getConnectFailures());
+    json.add("connect_ms", mqttHandler.getLastConnectMs());
+    json.add("blocked_ms", mqttHandler.getConnectBlockedMs());
+    json.add("retry_ms", mqttHandler.getReconnectDelay());
+    json.add("outbox", mqttHandler.getOutboxCount());
+    json.add("events_sent", mqttHandler.getEventsSent());
+    json.add("events_replayed", mqttHandler.getEventsReplayed());
+    json.add("events_dropped", mqttHandler.getEventsDropped());
+    json.add("events_coalesced", mqttHandler.getEventsCoalesced());
+    json.add("publish_stalls", mqttHandler.getPublishStalls());
+    json.add("publish_delay_ms", mqttHandler.getPublishDelay());
+    json.add("last_run_ms", mqttHandler.getLastRunMs());
+    json.add("last_run_msgs", mqttHandler.getLastRunSteps());
+    unsigned long runMs = mqttHandler.getLastRunMs();
+    json.add("last_run_rate", runMs ? mqttHandler.getLastRunSteps() * 1000UL / runMs : 0UL);  // msgs/s
+    json.endObject();
+
+    // Telemetry stream
+    json.beginObject("telemetry");
+    json.add("interval", telemetry.getInterval());
+    json.add("sent", telemetry.getBatchesSent());
+    json.add("dropped", telemetry.getBatchesDropped());
+    json.endObject();
+
+    // Settings write-back cache
+    json.beginObject("storage");
+    json.add("pending", storage.getPendingWrites());
+    json.add("dirty", storage.getDirtyFields());
+    json.add("flushed", storage.getFlushCount());
+    json.add("coalesced", storage.getCoalescedWrites());
+#ifndef PLATFORM_ESP8266
+    json.beginObject("nvs_writes");
+    for (uint8_t i = 0; i < Storage::NVS_KEY_COUNT; i++) {
+        json.add(storage.getNvsKeyName(i), storage.getNvsWriteCount(i));
     }
-    request->send(200, "application/json", response);
+    json.endObject();
+#endif
+    json.endObject();
+
+    json.endObject();
+    request->send(response);
+}
+
+// Prometheus text exposition: HELP/TYPE header, then the sample
+static void metricHeader(Print& out, const char* name, const char* type, const char* help) {
+    out.printf("# HELP diffuser_%s %s\n# TYPE diffuser_%s %s\n", name, help, name, type);
+}
+
+static void gauge(Print& out, const char* name, const char* help, long value) {
+    metricHeader(out, name, "gauge", help);
+    out.printf("diffuser_%s %ld\n", name, value);
+}
+
+static void counter(Print& out, const char* name, const char* help, unsigned long value) {
+    metricHeader(out, name, "counter", help);
+    out.printf("diffuser_%s %lu\n", name, value);
+}
+
+// Same counters as /api/diagnostic, in Prometheus text format. Written
+// line by line into the response stream - no document is built.
+void WebServer::handleMetrics(AsyncWebServerRequest* request) {
+#ifdef PLATFORM_ESP8266
+    AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4", 2048);
+    const char* platform = "ESP8266";
+#else
+    AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4", 3072);
+    const char* platform = "ESP32";
+#endif
+    Print& out = *response;
+
+    metricHeader(out, "info", "gauge", "Firmware version and platform");
+    out.printf("diffuser_info{version=\"%s\",platform=\"%s\"} 1\n", FIRMWARE_VERSION, platform);
+    gauge(out, "uptime_seconds", "Time since boot", millis() / 1000);
+
+    // Fan
+    gauge(out, "fan_on", "Fan switched on", fanController.isOn());
+    gauge(out, "fan_speed_percent", "Fan speed setting", fanController.getSpeed());
+    gauge(out, "fan_rpm", "Measured fan speed", fanController.getRPM());
+    gauge(out, "fan_pwm", "Raw PWM duty (0-255)", fanController.getCurrentPWMValue());
+    gauge(out, "fan_interval_mode", "Interval mode enabled", fanController.isIntervalMode());
+    gauge(out, "fan_timer_remaining_minutes", "Minutes left on the timer (0 = no timer)",
+          fanController.isTimerActive() ? fanController.getRemainingMinutes() : 0);
+    counter(out, "fan_runtime_seconds_total", "Total fan runtime", storage.getTotalRuntimeMinutes() * 60UL);
+
+    // WiFi
+    gauge(out, "wifi_connected", "Connected to the WiFi network", wifiManager.isConnected());
+    gauge(out, "wifi_rssi_dbm", "WiFi signal strength", wifiManager.getRSSI());
+    counter(out, "wifi_connects_total", "WiFi connections since boot", wifiManager.getConnectCount());
+    counter(out, "wifi_disconnects_total", "WiFi connections lost since boot", wifiManager.getDisconnectCount());
+
+    // MQTT
+    gauge(out, "mqtt_connected", "Connected to the MQTT broker", mqttHandler.isConnected());
+    counter(out, "mqtt_connect_attempts_total", "MQTT connect attempts", mqttHandler.getConnectAttempts());
+    counter(out, "mqtt_connect_failures_total", "Failed MQTT connect attempts", mqttHandler.getConnectFailures());
+    counter(out, "mqtt_state_publishes_total", "State messages published", mqttHandler.getStatePublishes());
+    counter(out, "mqtt_state_publish_failures_total", "State messages refused by the client", mqttHandler.getStatePublishFailures());
+    counter(out, "mqtt_publish_stalls_total", "Publish backpressure events", mqttHandler.getPublishStalls());
+    counter(out, "mqtt_events_sent_total", "Events published (first write)", mqttHandler.getEventsSent());
+    counter(out, "mqtt_events_replayed_total", "Events resent after a reconnect", mqttHandler.getEventsReplayed());
+    counter(out, "mqtt_events_dropped_total", "Events dropped from a full outbox", mqttHandler.getEventsDropped());
+    gauge(out, "mqtt_outbox_events", "Events waiting in the outbox", mqttHandler.getOutboxCount());
+
+    // Memory
+    gauge(out, "heap_free_bytes", "Free heap", ESP.getFreeHeap());
+    gauge(out, "heap_max_block_bytes", "Largest allocatable heap block", maxFreeBlock());
+
+    counter(out, "fan_commands_total", "Fan commands received over HTTP", _fanCommandsReceived);
+    counter(out, "fan_command_applies_total", "Merged fan commands applied", _fanCommandsApplied);
+
+    // HTTP admission control
+    gauge(out, "http_in_flight", "HTTP requests in flight", _inFlight);
+    counter(out, "http_rejected_total", "HTTP requests answered with 503", _admissionRejects);
+
+    // Main loop - one pass, without the trailing delay()
+    LoopStats loopSnapshot = loopStats;
+    metricHeader(out, "loop_duration_seconds", "summary", "Main loop pass duration");
+    out.printf("diffuser_loop_duration_seconds_sum %.6f\n", loopSnapshot.totalUs / 1e6);
+    out.printf("diffuser_loop_duration_seconds_count %lu\n", (unsigned long)loopSnapshot.count);
+    metricHeader(out, "loop_max_seconds", "gauge", "Longest main loop pass since the previous scrape");
+    out.printf("diffuser_loop_max_seconds %.6f\n", takeLoopMax() / 1e6);
+
+    // Logs and storage
+    metricHeader(out, "log_entries_total", "counter", "Log entries since boot");
+    out.printf("diffuser_log_entries_total{level=\"info\"} %lu\n", (unsigned long)logger.getLevelCount(LogLevel::INFO));
+    out.printf("diffuser_log_entries_total{level=\"warn\"} %lu\n", (unsigned long)logger.getLevelCount(LogLevel::WARN));
+    out.printf("diffuser_log_entries_total{level=\"error\"} %lu\n", (unsigned long)logger.getLevelCount(LogLevel::ERROR));
+    counter(out, "storage_commits_total", "Settings commits to flash", storage.getFlushCount());
+
+#if defined(RC522_ENABLED)
+    // RFID
+    gauge(out, "rfid_reader_connected", "RC522 reader detected", rfidIsConnected());
+    gauge(out, "rfid_cartridge_present", "Cartridge in the diffuser", rfidIsCartridgePresent());
+#endif
+
+    request->send(response);
 }
 
 void WebServer::handleDiagnosticLed(AsyncWebServerRequest* request) {
@@ -1085,19 +1960,59 @@ void WebServer::handleDiagnosticFan(AsyncWebServerRequest* request) {
 }
 
 void WebServer::handleDiagnosticButtons(AsyncWebServerRequest* request) {
-    StaticJsonDocument<128> doc;
+    AsyncResponseStream* response = request->beginResponseStream("application/json", 96);
+    JsonWriter json(*response);
+    json.beginObject();
+    json.beginObject("front");
+    json.add("pressed", buttonHandler.isFrontPressed());
+    json.add("pin", BUTTON_FRONT_PIN);
+    json.endObject();
+    json.beginObject("rear");
+    json.add("pressed", buttonHandler.isRearPressed());
+    json.add("pin", BUTTON_REAR_PIN);
+    json.endObject();
+    json.endObject();
+    request->send(response);
+}
 
-    doc["front"]["pressed"] = buttonHandler.isFrontPressed();
-    doc["front"]["pin"] = BUTTON_FRONT_PIN;
-    doc["rear"]["pressed"] = buttonHandler.isRearPressed();
-    doc["rear"]["pin"] = BUTTON_REAR_PIN;
+static const char* methodName(uint8_t method) {
+    switch (method) {
+        case HTTP_GET:      return "GET";
+        case HTTP_POST:     return "POST";
+        case HTTP_DELETE:   return "DELETE";
+        case HTTP_PUT:      return "PUT";
+        default:            return "ANY";
+    }
+}
 
-    String response;
-    if (serializeJson(doc, response) == 0) {
-        request->send(500, "application/json", "{\"error\":\"JSON serialization failed\"}");
-        return;
+// Per-route accounting, in registration order ("*" = not found / captive redirect)
+void WebServer::handleDiagnosticRoutes(AsyncWebServerRequest* request) {
+    AsyncResponseStream* response = request->beginResponseStream("application/json", 2048);
+    JsonWriter json(*response);
+    json.beginObject();
+    json.add("heap", ESP.getFreeHeap());
+    json.add("max_block", maxFreeBlock());
+    json.add("slow_ms", WEB_SLOW_REQUEST_MS);
+    json.add("in_flight", _inFlight);
+    json.add("peak_in_flight", _peakInFlight);
+    json.add("rejected", _admissionRejects);
+    json.beginArray("routes");
+    for (uint8_t i = 0; i < _routeCount; i++) {
+        const RouteStats& stats = _routes[i];
+        json.beginObject();
+        json.add("uri", stats.uri);
+        json.add("method", methodName(stats.method));
+        json.add("count", stats.count);
+        json.add("avg_us", stats.count ? (unsigned long)(stats.totalUs / stats.count) : 0UL);
+        json.add("max_us", stats.maxUs);
+        json.add("slow", stats.slow);
+        json.add("heap_drop", stats.maxHeapDrop);
+        json.add("block_drop", stats.maxBlockDrop);
+        json.endObject();
     }
-    request->send(200, "application/json", response);
+    json.endArray();
+    json.endObject();
+    request->send(response);
 }
 
 // ==========================================
@@ -1112,31 +2027,29 @@ void WebServer::handleUpdateCheck(AsyncWebServerRequest* request) {
 }
 
 void WebServer::handleUpdateStatus(AsyncWebServerRequest* request) {
-    StaticJsonDocument<384> doc;
     const UpdateInfo& info = updateChecker.getInfo();
-
-    doc["available"] = info.available;
-    doc["current"] = info.currentVersion;
-    doc["latest"] = info.latestVersion;
-    doc["release_url"] = info.releaseUrl;
-    doc["state"] = (int)updateChecker.getState();
-    doc["progress"] = info.downloadProgress;
-    doc["error"] = info.errorMessage;
-    doc["last_check"] = info.lastCheckTime;
+    AsyncResponseStream* response = request->beginResponseStream("application/json", 384);
+    JsonWriter json(*response);
+    json.beginObject();
+
+    json.add("available", info.available);
+    json.add("current", info.currentVersion);
+    json.add("latest", info.latestVersion);
+    json.add("release_url", info.releaseUrl);
+    json.add("state", (int)updateChecker.getState());
+    json.add("progress", info.downloadProgress);
+    json.add("error", info.errorMessage);
+    json.add("last_check", info.lastCheckTime);
 
     #ifndef PLATFORM_ESP8266
-    doc["can_auto_update"] = true;
-    doc["download_url"] = info.downloadUrl;
+    json.add("can_auto_update", true);
+    json.add("download_url", info.downloadUrl);
     #else
-    doc["can_auto_update"] = false;
+    json.add("can_auto_update", false);
     #endif
 
-    String response;
-    if (serializeJson(doc, response) == 0) {
-        request->send(500, "application/json", "{\"error\":\"JSON serialization failed\"}");
-        return;
-    }
-    request->send(200, "application/json", response);
+    json.endObject();
+    request->send(response);
 }
 
 #ifndef PLATFORM_ESP8266
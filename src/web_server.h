@@ -5,6 +5,9 @@
 #include <ESPAsyncWebServer.h>
 #include "config.h"
 
+class JsonWriter;
+struct WebAsset;
+
 class WebServer {
 public:
     void begin();
@@ -37,23 +40,89 @@ private:
     #endif
     unsigned long _pendingActionTime = 0;
 
+    // Latest-wins slot for /api/fan, applied by loop() once per tick
+    enum FanCommandField : uint8_t {
+        FAN_CMD_POWER          = 1 << 0,
+        FAN_CMD_SPEED          = 1 << 1,
+        FAN_CMD_TIMER          = 1 << 2,
+        FAN_CMD_INTERVAL       = 1 << 3,
+        FAN_CMD_INTERVAL_TIMES = 1 << 4
+    };
+    struct FanCommand {
+        uint8_t fields;             // FanCommandField bits set since the last apply
+        bool power;
+        uint8_t speed;
+        uint16_t timer;             // Minutes, 0 = cancel
+        bool interval;
+        uint8_t intervalOn;
+        uint8_t intervalOff;
+    };
+    FanCommand _fanCommand = {};
+    unsigned long _lastFanCommand = 0;
+    uint32_t _fanCommandsReceived = 0;
+    uint32_t _fanCommandsApplied = 0;
+
+    char _indexEtag[11] = "";       // "xxxxxxxx" hash of index.html, empty if missing
+    bool _embeddedUI = false;       // Serving the UI compiled into the firmware
+
+    // Per-route accounting of the handler itself. The heap figures are the
+    // drop across the handler, i.e. mostly the response it left queued.
+    struct RouteStats {
+        const char* uri;
+        uint8_t method;
+        uint32_t count;
+        uint64_t totalUs;
+        uint32_t maxUs;
+        uint16_t slow;              // Calls above WEB_SLOW_REQUEST_MS
+        uint16_t maxHeapDrop;       // Worst free heap drop (bytes)
+        uint16_t maxBlockDrop;      // Worst largest-free-block drop (bytes)
+    };
+    RouteStats _routes[WEB_ROUTE_STATS_MAX];
+    uint8_t _routeCount = 0;
+
     void setupRoutes();
+    AsyncCallbackWebHandler& route(const char* uri, WebRequestMethodComposite method,
+                                   ArRequestHandlerFunction handler,
+                                   ArUploadHandlerFunction upload = nullptr,
+                                   ArBodyHandlerFunction body = nullptr);
+    ArRequestHandlerFunction instrument(const char* uri, WebRequestMethodComposite method,
+                                        ArRequestHandlerFunction handler);
+    static void recordRoute(RouteStats& stats, uint32_t us, uint32_t heapBefore, uint32_t blockBefore);
+
+    // Admission control (AdmissionHandler in web_server.cpp)
+    friend class AdmissionHandler;
+    uint8_t _inFlight = 0;          // Requests between headers and disconnect
+    uint8_t _peakInFlight = 0;
+    uint32_t _admissionRejects = 0;
+    void hashIndex();
+    bool filesystemUINewer();
+    void handleIndex(AsyncWebServerRequest* request);
+#ifdef WEB_EMBEDDED_UI
+    void handleEmbedded(AsyncWebServerRequest* request, const WebAsset& asset);
+#endif
     void handleStatus(AsyncWebServerRequest* request);
+    void renderStatus(JsonWriter& json, uint8_t sections);
     void handleStatusLite(AsyncWebServerRequest* request);
     void handleSaveWifi(AsyncWebServerRequest* request);
     void handleSaveMqtt(AsyncWebServerRequest* request);
     void handleFanControl(AsyncWebServerRequest* request);
+    FanCommand postFanCommand(const FanCommand& command);
+    void applyFanCommand();
     void handleReset(AsyncWebServerRequest* request);
     void handleSavePasswords(AsyncWebServerRequest* request);
     void handleGetPasswords(AsyncWebServerRequest* request);
     void handleGetNightMode(AsyncWebServerRequest* request);
     void handleSaveNightMode(AsyncWebServerRequest* request);
+    void handleSaveSettings(AsyncWebServerRequest* request);
+
+    void handleMetrics(AsyncWebServerRequest* request);
 
     // Hardware diagnostics
     void handleDiagnostic(AsyncWebServerRequest* request);
     void handleDiagnosticLed(AsyncWebServerRequest* request);
     void handleDiagnosticFan(AsyncWebServerRequest* request);
     void handleDiagnosticButtons(AsyncWebServerRequest* request);
+    void handleDiagnosticRoutes(AsyncWebServerRequest* request);
 
     // Update checker
     void handleUpdateCheck(AsyncWebServerRequest* request);
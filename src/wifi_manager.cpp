@@ -2,6 +2,7 @@
 #include "config.h"
 #include "storage.h"
 #include "logger.h"
+#include "state_version.h"
 
 // WiFi library is included via wifi_manager.h
 
@@ -230,6 +231,14 @@ String WiFiManager::getIP() {
     return WiFi.localIP().toString();
 }
 
+const char* WiFiManager::getSSIDCStr() {
+    return _state == WifiStatus::AP_MODE ? _apName : _ssid;
+}
+
+IPAddress WiFiManager::getIPAddress() {
+    return _state == WifiStatus::AP_MODE ? WiFi.softAPIP() : WiFi.localIP();
+}
+
 int8_t WiFiManager::getRSSI() {
     if (_state == WifiStatus::CONNECTED) {
         return WiFi.RSSI();
@@ -251,7 +260,10 @@ void WiFiManager::onStateChange(StateChangeCallback callback) {
 
 void WiFiManager::setState(WifiStatus state) {
     if (_state != state) {
+        if (state == WifiStatus::CONNECTED) _connectCount++;
+        if (_state == WifiStatus::CONNECTED) _disconnectCount++;
         _state = state;
+        bumpStateVersion();
         if (_callback) {
             _callback(state);
         }
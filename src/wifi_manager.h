@@ -38,9 +38,13 @@ public:
     WifiStatus getState();
     String getSSID();
     String getIP();
+    const char* getSSIDCStr();      // No heap allocation (status JSON)
+    IPAddress getIPAddress();
     int8_t getRSSI();
     String getMacAddress();
     String getAPName();
+    uint32_t getConnectCount() const { return _connectCount; }        // Connections since boot
+    uint32_t getDisconnectCount() const { return _disconnectCount; }  // Connections lost since boot
 
     // Callback
     typedef void (*StateChangeCallback)(WifiStatus status);
@@ -51,6 +55,8 @@ private:
     unsigned long _connectStartTime = 0;
     unsigned long _lastReconnectAttempt = 0;
     uint8_t _reconnectAttempts = 0;
+    uint32_t _connectCount = 0;
+    uint32_t _disconnectCount = 0;
     // Use char arrays instead of String to reduce heap fragmentation
     char _ssid[33];         // Max SSID 32 + null
     char _password[64];     // Max WPA2 password 63 + null
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""Build the web UI: data_src/* -> data/*.gz
+
+style.css and script.js are referenced from index.html with a short content
+hash (style.css?v=1a2b3c4d), so the firmware can serve them with immutable
+caching and a changed file is always fetched under a new URL.
+
+data/ui_version.txt records the firmware version the UI was built with. A
+firmware with the embedded UI (tools/embed_web.py) only serves the
+filesystem copy when that version is newer than its own.
+
+Usage: python3 tools/build_web.py
+"""
+
+import gzip
+import hashlib
+import os
+import re
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+SRC = os.path.join(ROOT, "data_src")
+OUT = os.path.join(ROOT, "data")
+HASHED = ["style.css", "script.js"]
+VERSION_FILE = "ui_version.txt"
+
+
+def read(name):
+    with open(os.path.join(SRC, name), "rb") as f:
+        return f.read()
+
+
+def write_gz(name, content):
+    path = os.path.join(OUT, name + ".gz")
+    with open(path, "wb") as raw:
+        with gzip.GzipFile(filename=name, mode="wb", compresslevel=9, fileobj=raw, mtime=0) as gz:
+            gz.write(content)
+    print("%-12s %6d -> %5d bytes" % (name, len(content), os.path.getsize(path)))
+
+
+def firmware_version():
+    with open(os.path.join(ROOT, "src", "config.h")) as f:
+        return re.search(r'#define FIRMWARE_VERSION\s+"([^"]+)"', f.read()).group(1)
+
+
+def main():
+    index = read("index.html")
+    for name in HASHED:
+        digest = hashlib.sha1(read(name)).hexdigest()[:8]
+        for attr in (b'href="', b'src="'):
+            ref = attr + name.encode() + b'"'
+            index = index.replace(ref, attr + ("%s?v=%s" % (name, digest)).encode() + b'"')
+
+    for name in sorted(os.listdir(SRC)):
+        write_gz(name, index if name == "index.html" else read(name))
+
+    with open(os.path.join(OUT, VERSION_FILE), "w") as f:
+        f.write(firmware_version() + "\n")
+
+
+if __name__ == "__main__":
+    main()
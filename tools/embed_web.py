@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Embed the web UI in the firmware: data/*.gz -> src/web_assets.h
+
+Runs as a PlatformIO pre-build script (extra_scripts), so the header always
+matches the data/ directory the firmware is built with. With -DWEB_EMBEDDED_UI
+the web server serves these PROGMEM copies instead of opening files, unless
+a newer UI was uploaded to the filesystem (see data/ui_version.txt).
+
+Build data/ first with tools/build_web.py. Can also be run on its own:
+python3 tools/embed_web.py
+"""
+
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+DATA = os.path.join(ROOT, "data")
+OUT = os.path.join(ROOT, "src", "web_assets.h")
+HASHED = ["style.css", "script.js"]  # Same as build_web.py: immutable caching
+TYPES = {".html": "text/html", ".css": "text/css", ".js": "application/javascript"}
+
+
+def fnv1a(data):
+    """Same hash as WebServer::hashIndex(), so ETags match either source."""
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def c_name(name):
+    return "WEB_ASSET_" + "".join(c if c.isalnum() else "_" for c in name).upper()
+
+
+def main():
+    assets = sorted(f for f in os.listdir(DATA) if f.endswith(".gz"))
+    lines = [
+        "// Generated by tools/embed_web.py from data/*.gz - do not edit",
+        "#ifndef WEB_ASSETS_H",
+        "#define WEB_ASSETS_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "struct WebAsset {",
+        "    const char* path;",
+        "    const char* contentType;",
+        "    const uint8_t* data;    // gzip, PROGMEM",
+        "    size_t length;",
+        "    const char* etag;",
+        "    bool hashed;            // Requested by content hash, cache forever",
+        "};",
+        "",
+    ]
+    table = []
+    for gz in assets:
+        name = gz[:-3]
+        with open(os.path.join(DATA, gz), "rb") as f:
+            data = f.read()
+        lines.append("static const uint8_t %s[] PROGMEM = {" % c_name(name))
+        for i in range(0, len(data), 16):
+            lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+        lines.append("};")
+        lines.append("")
+        table.append('    {"/%s", "%s", %s, %d, "\\"%08x\\"", %s},' % (
+            name, TYPES.get(os.path.splitext(name)[1], "application/octet-stream"),
+            c_name(name), len(data), fnv1a(data), "true" if name in HASHED else "false"))
+        print("embedded %-12s %5d bytes" % (name, len(data)))
+
+    lines.append("static const WebAsset WEB_ASSETS[] = {")
+    lines.extend(table)
+    lines.append("};")
+    lines.append("")
+    lines.append("#endif // WEB_ASSETS_H")
+
+    content = "\n".join(lines) + "\n"
+    # Leave an unchanged header alone so it does not trigger a rebuild
+    if os.path.exists(OUT):
+        with open(OUT) as f:
+            if f.read() == content:
+                return
+    with open(OUT, "w") as f:
+        f.write(content)
+
+
+main()
@@ -0,0 +1,295 @@
+// Host benchmark: /api/status rendered the old way (DynamicJsonDocument,
+// serialised into a String, copied by request->send()) against JsonWriter
+// streaming into a growing buffer like AsyncResponseStream's cbuf.
+// Reports payload size, peak heap, allocations and CPU time per request.
+//
+// malloc/free are wrapped to track live bytes, so this needs glibc (Linux).
+// ArduinoJson 6 comes from the PlatformIO libdeps after one `pio run`:
+//
+//   g++ -O2 -std=gnu++17 -Isrc -Itools/json_bench -I.pio/libdeps/esp32dev/ArduinoJson/src
+//       tools/json_bench/json_bench.cpp src/json_writer.cpp -o /tmp/json_bench
+//   /tmp/json_bench
+//
+// Without ArduinoJson on the include path only the JsonWriter rows are run.
+// Host numbers compare the two paths; absolute values differ on the ESP.
+
+#include "json_writer.h"
+
+#include <chrono>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string>
+
+#if __has_include(<ArduinoJson.h>)
+    #include <ArduinoJson.h>
+    #define BENCH_ARDUINOJSON
+#endif
+
+// ---- Heap accounting ----------------------------------------------------
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static size_t heapLive = 0;
+static size_t heapPeak = 0;
+static size_t heapAllocs = 0;
+
+static void heapAdd(void* ptr) {
+    if (!ptr) return;
+    heapLive += malloc_usable_size(ptr);
+    if (heapLive > heapPeak) heapPeak = heapLive;
+    heapAllocs++;
+}
+
+extern "C" void* malloc(size_t size) {
+    void* ptr = __libc_malloc(size);
+    heapAdd(ptr);
+    return ptr;
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+    void* ptr = __libc_calloc(n, size);
+    heapAdd(ptr);
+    return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void* out = __libc_realloc(ptr, size);
+    if (out) {
+        heapLive -= old;
+        heapAdd(out);
+    }
+    return out;
+}
+
+extern "C" void free(void* ptr) {
+    if (ptr) heapLive -= malloc_usable_size(ptr);
+    __libc_free(ptr);
+}
+
+// ---- Response sinks -----------------------------------------------------
+
+// AsyncResponseStream: a cbuf of the size passed to beginResponseStream(),
+// grown by exactly the missing bytes when a write does not fit
+class ResponseBuffer : public Print {
+public:
+    explicit ResponseBuffer(size_t capacity) : _capacity(capacity) {
+        _data = (uint8_t*)malloc(capacity);
+    }
+    ~ResponseBuffer() { free(_data); }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        if (_length + size > _capacity) {
+            _capacity = _length + size;
+            _data = (uint8_t*)realloc(_data, _capacity);
+        }
+        memcpy(_data + _length, buffer, size);
+        _length += size;
+        return size;
+    }
+    size_t length() const { return _length; }
+
+private:
+    uint8_t* _data;
+    size_t _capacity;
+    size_t _length = 0;
+};
+
+// ---- /api/status --------------------------------------------------------
+
+// Typical values of a configured device with an update available
+struct Status {
+    bool wifiConnected = true;
+    bool apMode = false;
+    const char* ssid = "HomeNetwork-5G";
+    IPAddress ip = IPAddress(192, 168, 1, 42);
+    long rssi = -61;
+    bool mqttConnected = true;
+    const char* mqttHost = "homeassistant.local";
+    unsigned int mqttPort = 1883;
+    bool mqttJsonState = false;
+    unsigned int telemetry = 60;
+    bool fanOn = true;
+    unsigned int speed = 50;
+    unsigned int rpm = 1850;
+    bool timerActive = true;
+    unsigned int remaining = 42;
+    bool intervalMode = false;
+    unsigned int intervalOn = 30;
+    unsigned int intervalOff = 30;
+    const char* deviceName = "Rituals Diffuser";
+    const char* mac = "5C:CF:7F:12:34:56";
+    const char* version = "1.9.9";
+    double totalRuntime = 123.4;
+    unsigned long sessionRuntime = 17;
+    bool nightEnabled = true;
+    unsigned int nightStart = 22;
+    unsigned int nightEnd = 7;
+    unsigned int nightBrightness = 10;
+    bool updateAvailable = true;
+    const char* latest = "2.0.0";
+    const char* releaseUrl = "https://github.com/martijnrenkema/Rituals-diffuser/releases/tag/v2.0.0";
+    int updateState = 0;
+    int progress = 0;
+    const char* error = "";
+};
+
+// Same members and order as WebServer::renderStatus() (no RFID)
+static void renderWriter(JsonWriter& json, const Status& s) {
+    json.beginObject();
+    json.beginObject("wifi");
+    json.add("connected", s.wifiConnected);
+    json.add("ap_mode", s.apMode);
+    json.add("ssid", s.ssid);
+    json.add("ip", s.ip);
+    json.add("rssi", s.rssi);
+    json.endObject();
+    json.beginObject("mqtt");
+    json.add("connected", s.mqttConnected);
+    json.add("host", s.mqttHost);
+    json.add("port", s.mqttPort);
+    json.add("json_state", s.mqttJsonState);
+    json.add("telemetry", s.telemetry);
+    json.endObject();
+    json.beginObject("fan");
+    json.add("on", s.fanOn);
+    json.add("speed", s.speed);
+    json.add("rpm", s.rpm);
+    json.add("timer_active", s.timerActive);
+    json.add("remaining_minutes", s.remaining);
+    json.add("interval_mode", s.intervalMode);
+    json.add("interval_on", s.intervalOn);
+    json.add("interval_off", s.intervalOff);
+    json.endObject();
+    json.beginObject("device");
+    json.add("name", s.deviceName);
+    json.add("mac", s.mac);
+    json.add("version", s.version);
+    json.add("platform", "ESP32");
+    json.endObject();
+    json.beginObject("stats");
+    json.add("total_runtime", s.totalRuntime);
+    json.add("session_runtime", s.sessionRuntime);
+    json.endObject();
+    json.beginObject("night");
+    json.add("enabled", s.nightEnabled);
+    json.add("start", s.nightStart);
+    json.add("end", s.nightEnd);
+    json.add("brightness", s.nightBrightness);
+    json.endObject();
+    json.beginObject("update");
+    json.add("available", s.updateAvailable);
+    json.add("current", s.version);
+    json.add("latest", s.latest);
+    json.add("release_url", s.releaseUrl);
+    json.add("state", s.updateState);
+    json.add("progress", s.progress);
+    json.add("error", s.error);
+    json.add("can_auto_update", true);
+    json.endObject();
+    json.endObject();
+}
+
+#ifdef BENCH_ARDUINOJSON
+// The handler before JsonWriter: document, String, then the copy send() keeps
+static size_t renderDocument(const Status& s) {
+    DynamicJsonDocument doc(1536);
+    char ip[16];
+    snprintf(ip, sizeof(ip), "%u.%u.%u.%u", s.ip[0], s.ip[1], s.ip[2], s.ip[3]);
+    std::string ipString = ip;          // wifiManager.getIP() returned a String
+
+    doc["wifi"]["connected"] = s.wifiConnected;
+    doc["wifi"]["ap_mode"] = s.apMode;
+    doc["wifi"]["ssid"] = std::string(s.ssid);   // getSSID() returned a String
+    doc["wifi"]["ip"] = ipString;
+    doc["wifi"]["rssi"] = s.rssi;
+    doc["mqtt"]["connected"] = s.mqttConnected;
+    doc["mqtt"]["host"] = s.mqttHost;
+    doc["mqtt"]["port"] = s.mqttPort;
+    doc["mqtt"]["json_state"] = s.mqttJsonState;
+    doc["mqtt"]["telemetry"] = s.telemetry;
+    doc["fan"]["on"] = s.fanOn;
+    doc["fan"]["speed"] = s.speed;
+    doc["fan"]["rpm"] = s.rpm;
+    doc["fan"]["timer_active"] = s.timerActive;
+    doc["fan"]["remaining_minutes"] = s.remaining;
+    doc["fan"]["interval_mode"] = s.intervalMode;
+    doc["fan"]["interval_on"] = s.intervalOn;
+    doc["fan"]["interval_off"] = s.intervalOff;
+    doc["device"]["name"] = s.deviceName;
+    doc["device"]["mac"] = std::string(s.mac);   // getMacAddress() returned a String
+    doc["device"]["version"] = s.version;
+    doc["device"]["platform"] = "ESP32";
+    doc["stats"]["total_runtime"] = s.totalRuntime;
+    doc["stats"]["session_runtime"] = s.sessionRuntime;
+    doc["night"]["enabled"] = s.nightEnabled;
+    doc["night"]["start"] = s.nightStart;
+    doc["night"]["end"] = s.nightEnd;
+    doc["night"]["brightness"] = s.nightBrightness;
+    doc["update"]["available"] = s.updateAvailable;
+    doc["update"]["current"] = s.version;
+    doc["update"]["latest"] = s.latest;
+    doc["update"]["release_url"] = s.releaseUrl;
+    doc["update"]["state"] = s.updateState;
+    doc["update"]["progress"] = s.progress;
+    doc["update"]["error"] = s.error;
+    doc["update"]["can_auto_update"] = true;
+
+    std::string response;
+    serializeJson(doc, response);
+    std::string sent = response;        // AsyncBasicResponse keeps its own copy
+    return sent.size();
+}
+#endif
+
+static size_t renderJson(const Status& s) {
+    ResponseBuffer response(1152);      // Same size as handleStatus()
+    JsonWriter json(response);
+    renderWriter(json, s);
+    return response.length();
+}
+
+static size_t renderMsgpack(const Status& s) {
+    JsonWriter sizes;
+    renderWriter(sizes, s);
+    ResponseBuffer response(1024);
+    JsonWriter msgpack(response, sizes);
+    renderWriter(msgpack, s);
+    return response.length();
+}
+
+// ---- Runner -------------------------------------------------------------
+
+static void run(const char* name, size_t (*render)(const Status&)) {
+    const int iterations = 20000;
+    Status status;
+
+    size_t base = heapLive;
+    heapPeak = heapLive;
+    heapAllocs = 0;
+    size_t bytes = render(status);
+    size_t peak = heapPeak - base;
+    size_t allocs = heapAllocs;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) render(status);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-38s %6zu %10zu %7zu %9.2f\n", name, bytes, peak, allocs, us / iterations);
+}
+
+int main() {
+    printf("%-38s %6s %10s %7s %9s\n", "/api/status", "bytes", "peak heap", "allocs", "us/req");
+#ifdef BENCH_ARDUINOJSON
+    run("JsonDocument + String + send() copy", renderDocument);
+#else
+    printf("(ArduinoJson not on the include path - JsonDocument row skipped)\n");
+#endif
+    run("JsonWriter -> response buffer", renderJson);
+    run("JsonWriter MessagePack (two passes)", renderMsgpack);
+    return 0;
+}
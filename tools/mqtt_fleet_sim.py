@@ -0,0 +1,564 @@
+#!/usr/bin/env python3
+"""MQTT fleet load simulator.
+
+Models a fleet of diffusers reconnecting to one broker at the same time
+(e.g. after a power cut) and measures what the broker sees. This is a model
+of the firmware's MQTT sequence (src/mqtt_handler.cpp), not the firmware
+itself - payloads and topics are rendered the same way, timing is not:
+
+  - connect with a retained "offline" last will, backoff 5 s doubling to
+    300 s plus up to 25% jitter on failure (also for a refused CONNACK)
+  - retained "online" availability
+  - one retained discovery config per entity, or one device-based config
+    (--device-discovery); skipped when the stored discovery hash matches
+    (see --cold), and a cold start also clears the other format once
+  - every state topic retained, or one JSON state message (--json-state)
+  - subscribe to the command topics and homeassistant/status
+  - a Home Assistant birth triggers a state refresh after a per-device
+    jitter; a birth replayed within 3 s of subscribing (retained) is ignored
+
+Publishing runs in bursts of MQTT_PUBLISH_BURST steps per 10 ms loop pass,
+like processPublishStateMachine(), without modelling TCP backpressure.
+
+"host ms per publish step" is the Python/paho time spent per publish on
+this machine. It is only useful to compare runs of this script; it says
+nothing about device CPU. On hardware use mqtt.last_run_ms and
+mqtt.last_run_msgs in /api/diagnostic.
+
+Needs a broker: mosquitto, or --builtin-broker for a minimal in-process
+MQTT 3.1.1 broker (QoS 0, retained messages, wills) when none is installed.
+
+Usage:
+  pip install "paho-mqtt==2.1.0"   # Version the results were taken with; 1.6+ also works
+  mosquitto -v &
+  python3 tools/mqtt_fleet_sim.py --devices 100 --boot-spread 2 --cold
+  python3 tools/mqtt_fleet_sim.py --devices 100 --ha-restart
+  python3 tools/mqtt_fleet_sim.py --builtin-broker --port 18830 --devices 50 --cold
+"""
+
+import argparse
+import heapq
+import json
+import os
+import random
+import re
+import socket
+import struct
+import threading
+import time
+import zlib
+
+import paho.mqtt.client as mqtt
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+# Mirrors config.h / mqtt_handler.cpp
+TOPIC_PREFIX = "rituals_diffuser"
+DISCOVERY_PREFIX = "homeassistant"
+RECONNECT_INTERVAL = 5.0
+RECONNECT_MAX_INTERVAL = 300.0
+HA_BIRTH_JITTER = 10.0
+HA_BIRTH_RETAINED = 3.0
+PUBLISH_BURST = 8
+LOOP_INTERVAL = 0.01  # One firmware loop() pass
+
+
+def config_define(name):
+    with open(os.path.join(ROOT, "src", "config.h")) as f:
+        return re.search(r'#define %s\s+"([^"]+)"' % name, f.read()).group(1)
+
+
+FIRMWARE_VERSION = config_define("FIRMWARE_VERSION")
+GITHUB_REPO = config_define("UPDATE_GITHUB_REPO")
+
+# State fields: (topic suffix, JSON key, numeric, simulated value)
+STATE_FIELDS = [
+    ("/fan/state", "fan", False, "ON"),
+    ("/fan/speed", "speed", True, "50"),
+    ("/fan/preset", "preset", False, "Cont"),
+    ("/interval/state", "interval", False, "OFF"),
+    ("/interval_on/state", "interval_on", True, "30"),
+    ("/interval_off/state", "interval_off", True, "30"),
+    ("/remaining_time", "remaining", True, "0"),
+    ("/rpm", "rpm", True, "1850"),
+    ("/wifi_signal", "rssi", True, "-61"),
+    ("/total_runtime", "runtime", True, "123.4"),
+    ("/update_available", "update", False, "OFF"),
+    ("/latest_version", "latest", False, FIRMWARE_VERSION),
+    ("/current_version", "version", False, FIRMWARE_VERSION),
+    ("/scent", "scent", False, "No cartridge"),          # RFID builds only
+    ("/cartridge_present", "cartridge", False, "OFF"),   # RFID builds only
+]
+RFID_FIELDS = 2
+
+# Entities: (component, object id suffix, state field index, body template).
+# The templates are renderDiscoveryBody(); {st} is the state topic attribute.
+ENTITIES = [
+    ("fan", "", 0,
+     '"name":"Diffuser","uniq_id":"rd_{id}",{st},"cmd_t":"{base}/fan/set",{pct},'
+     '"pct_cmd_t":"{base}/fan/speed/set",{pre},"pr_mode_cmd_t":"{base}/fan/preset/set",'
+     '"pr_modes":["30m","60m","90m","120m","Cont"],{attr}"spd_rng_min":1,"spd_rng_max":100'),
+    ("switch", "_int", 3,
+     '"name":"Interval Mode","uniq_id":"rd_{id}_int",{st},"cmd_t":"{base}/interval/set",'
+     '"ic":"mdi:timer-sand"'),
+    ("number", "_ion", 4,
+     '"name":"Interval On","uniq_id":"rd_{id}_ion",{st},"cmd_t":"{base}/interval_on/set",'
+     '"min":10,"max":120,"step":5,"unit_of_meas":"s","ic":"mdi:timer"'),
+    ("number", "_ioff", 5,
+     '"name":"Interval Off","uniq_id":"rd_{id}_ioff",{st},"cmd_t":"{base}/interval_off/set",'
+     '"min":10,"max":120,"step":5,"unit_of_meas":"s","ic":"mdi:timer-off"'),
+    ("sensor", "_rem", 6,
+     '"name":"Time Left","uniq_id":"rd_{id}_rem",{st},"unit_of_meas":"min","ic":"mdi:clock-outline"'),
+    ("sensor", "_rpm", 7,
+     '"name":"Fan RPM","uniq_id":"rd_{id}_rpm",{st},"unit_of_meas":"RPM","ic":"mdi:fan",'
+     '"ent_cat":"diagnostic"'),
+    ("sensor", "_wifi", 8,
+     '"name":"WiFi Signal","uniq_id":"rd_{id}_wifi",{st},"unit_of_meas":"dBm",'
+     '"dev_cla":"signal_strength","ent_cat":"diagnostic"'),
+    ("sensor", "_trun", 9,
+     '"name":"Total Runtime","uniq_id":"rd_{id}_trun",{st},"unit_of_meas":"h",'
+     '"ic":"mdi:clock-check","ent_cat":"diagnostic"'),
+    ("binary_sensor", "_upd", 10,
+     '"name":"Update Available","uniq_id":"rd_{id}_upd",{st},"dev_cla":"update","ent_cat":"diagnostic"'),
+    ("sensor", "_latver", 11,
+     '"name":"Latest Version","uniq_id":"rd_{id}_latver",{st},"ic":"mdi:package-up","ent_cat":"diagnostic"'),
+    ("sensor", "_curver", 12,
+     '"name":"Firmware Version","uniq_id":"rd_{id}_curver",{st},"ic":"mdi:chip","ent_cat":"diagnostic"'),
+    ("sensor", "_scent", 13,
+     '"name":"Scent Cartridge","uniq_id":"rd_{id}_scent",{st},"ic":"mdi:spray"'),
+    ("binary_sensor", "_cartridge", 14,
+     '"name":"Cartridge Present","uniq_id":"rd_{id}_cartridge",{st},"dev_cla":"presence",'
+     '"ic":"mdi:tag-outline"'),
+]
+
+COMMAND_TOPICS = [
+    "/fan/set", "/fan/speed/set", "/fan/preset/set", "/interval/set",
+    "/interval_on/set", "/interval_off/set",
+]
+
+
+def new_client(client_id):
+    # paho-mqtt 2.x requires the callback API version, 1.x does not know it.
+    # The callbacks below accept both signatures.
+    if hasattr(mqtt, "CallbackAPIVersion"):
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=client_id, clean_session=True)
+    return mqtt.Client(client_id=client_id, clean_session=True)
+
+
+def state_topic(base, field, json_state, topic_key, tpl_key):
+    """formatStateTopic()"""
+    if json_state:
+        return '"%s":"%s/state","%s":"{{value_json.%s}}"' % (topic_key, base, tpl_key, STATE_FIELDS[field][1])
+    return '"%s":"%s%s"' % (topic_key, base, STATE_FIELDS[field][0])
+
+
+def discovery_body(entity, device_id, base, json_state):
+    component, suffix, field, template = entity
+    return template.format(
+        id=device_id, base=base,
+        st=state_topic(base, field, json_state, "stat_t", "stat_val_tpl" if field == 0 else "val_tpl"),
+        pct=state_topic(base, 1, json_state, "pct_stat_t", "pct_val_tpl"),
+        pre=state_topic(base, 2, json_state, "pr_mode_stat_t", "pr_mode_val_tpl"),
+        attr='"json_attr_t":"%s/state",' % base if json_state else "")
+
+
+def entity_discovery(entity, device_id, base, json_state):
+    """publishEntityDiscovery(): only the fan carries the full device block"""
+    device = '"name":"Rituals Diffuser","mf":"Rituals","mdl":"Genie 2.0"' if entity[1] == "" else ""
+    return ('{%s,"avty_t":"%s/availability","dev":{"ids":["rituals_%s"]%s}}'
+            % (discovery_body(entity, device_id, base, json_state), base, device_id, "," + device if device else ""))
+
+
+def device_discovery(device_id, base, entities, json_state):
+    """streamDeviceDiscovery(): the device block once, every entity under cmps"""
+    cmps = ",".join('"rd_%s%s":{"p":"%s",%s}' % (device_id, e[1], e[0], discovery_body(e, device_id, base, json_state))
+                    for e in entities)
+    return ('{"dev":{"ids":["rituals_%s"],"name":"Rituals Diffuser","mf":"Rituals","mdl":"Genie 2.0","sw":"%s"},'
+            '"o":{"name":"Rituals-diffuser","sw":"%s","url":"https://github.com/%s"},'
+            '"avty_t":"%s/availability","cmps":{%s}}'
+            % (device_id, FIRMWARE_VERSION, FIRMWARE_VERSION, GITHUB_REPO, base, cmps))
+
+
+def state_json(fields):
+    """renderStateJson()"""
+    return "{" + ",".join('"%s":%s' % (key, value if numeric else json.dumps(value))
+                          for _, key, numeric, value in fields) + "}"
+
+
+class Device:
+    def __init__(self, index, args, stats):
+        self.id = "%012x" % (0x5CCF7F000000 + index)
+        self.base = "%s_%s" % (TOPIC_PREFIX, self.id)
+        self.args = args
+        self.stats = stats
+        self.entities = ENTITIES if args.rfid else ENTITIES[:-RFID_FIELDS]
+        self.fields = STATE_FIELDS if args.rfid else STATE_FIELDS[:-RFID_FIELDS]
+        self.discovery_cached = not args.cold   # Stored hash matches the broker
+        self.connected = False
+        self.refused = False
+        self.backoff = 0.0
+        self.queue = []
+        self.birth_jitter = (zlib.crc32(self.id.encode()) % int(HA_BIRTH_JITTER * 1000)) / 1000.0
+        self.birth_at = None
+        self.subscribed_at = 0.0
+        self.step_time = 0.0
+        self.steps = 0
+
+        self.client = new_client("rituals-" + self.id)
+        self.client.will_set(self.base + "/availability", "offline", qos=0, retain=True)
+        self.client.on_connect = self.on_connect
+        self.client.on_disconnect = self.on_disconnect
+        self.client.on_message = self.on_message
+
+    # Network callbacks run on the paho thread; the loop below only reads flags
+    def on_connect(self, client, userdata, flags, rc, properties=None):
+        if rc != 0:
+            self.refused = True
+            return
+        self.connected = True
+        self.backoff = 0.0
+        self.stats.connected(self)
+        for suffix in COMMAND_TOPICS:
+            client.subscribe(self.base + suffix)
+        client.subscribe(DISCOVERY_PREFIX + "/status")
+        self.subscribed_at = time.monotonic()
+
+    def on_disconnect(self, client, userdata, *args):
+        self.connected = False
+
+    def on_message(self, client, userdata, msg):
+        if msg.topic != DISCOVERY_PREFIX + "/status" or msg.payload != b"online":
+            return
+        # Like the firmware, judge by timing: PubSubClient hides the retain flag
+        if time.monotonic() - self.subscribed_at < HA_BIRTH_RETAINED:
+            self.stats.births_ignored += 1
+            return
+        self.birth_at = time.monotonic() + self.birth_jitter
+
+    def backoff_delay(self):
+        self.stats.failures += 1
+        self.backoff = min(self.backoff * 2, RECONNECT_MAX_INTERVAL) if self.backoff else RECONNECT_INTERVAL
+        return self.backoff + random.uniform(0, self.backoff / 4)
+
+    def connect(self):
+        """One connect attempt; returns the delay until the next attempt, None if pending."""
+        self.refused = False
+        try:
+            self.client.connect(self.args.host, self.args.port, keepalive=60)
+            self.client.loop_start()
+            self.queue = self.publish_plan()
+            return None
+        except OSError:
+            return self.backoff_delay()
+
+    def check_refused(self):
+        """CONNACK with rc != 0: back off like connectFailed()."""
+        if not self.refused:
+            return None
+        self.refused = False
+        self.client.loop_stop()
+        self.client.disconnect()
+        return self.backoff_delay()
+
+    def state_plan(self):
+        if self.args.json_state:
+            return [(self.base + "/state", state_json(self.fields))]
+        return [(self.base + suffix, value) for suffix, _, _, value in self.fields]
+
+    def publish_plan(self):
+        plan = [(self.base + "/availability", "online")]
+        if not self.discovery_cached:
+            # No stored hash: clear the other format once
+            device_topic = "%s/device/rd_%s/config" % (DISCOVERY_PREFIX, self.id)
+            entity_topics = ["%s/%s/rd_%s%s/config" % (DISCOVERY_PREFIX, e[0], self.id, e[1]) for e in self.entities]
+            if self.args.device_discovery:
+                plan += [(topic, "") for topic in entity_topics]
+                plan.append((device_topic, device_discovery(self.id, self.base, self.entities, self.args.json_state)))
+            else:
+                plan.append((device_topic, ""))
+                plan += [(topic, entity_discovery(e, self.id, self.base, self.args.json_state))
+                         for topic, e in zip(entity_topics, self.entities)]
+        return plan + self.state_plan()
+
+    def loop(self):
+        """One firmware loop() pass: a bounded burst of publish steps."""
+        if not self.connected:
+            return
+        if not self.queue and self.birth_at is not None and time.monotonic() >= self.birth_at:
+            # Discovery hash unchanged: the birth only refreshes state
+            self.birth_at = None
+            self.queue = self.state_plan()
+        if not self.queue:
+            return
+        start = time.perf_counter()
+        for _ in range(PUBLISH_BURST):
+            if not self.queue:
+                break
+            topic, payload = self.queue.pop(0)
+            self.client.publish(topic, payload, qos=0, retain=True)
+            self.steps += 1
+        self.step_time += time.perf_counter() - start
+        if not self.queue:
+            self.discovery_cached = True
+
+
+class Stats:
+    """Counts what the broker delivers to a monitor subscribed to everything."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.start = time.monotonic()
+        self.per_second = {}
+        self.bytes = 0
+        self.failures = 0
+        self.births_ignored = 0
+        self.connect_times = []
+        self.expected = {}
+        self.complete = {}
+
+    def connected(self, device):
+        with self.lock:
+            self.connect_times.append(time.monotonic() - self.start)
+
+    def on_message(self, client, userdata, msg):
+        if msg.retain:
+            return  # Replayed to the monitor on subscribe, not fleet traffic
+        now = time.monotonic() - self.start
+        with self.lock:
+            second = int(now)
+            self.per_second[second] = self.per_second.get(second, 0) + 1
+            self.bytes += len(msg.topic) + len(msg.payload)
+            # A device counts as visible once its last state topic arrived
+            base = self.expected.get(msg.topic)
+            if base and base not in self.complete:
+                self.complete[base] = now
+
+
+class Broker:
+    """Minimal MQTT 3.1.1 broker for --builtin-broker: QoS 0 only, retained
+    messages, last wills, + and # wildcards. One thread per connection."""
+
+    def __init__(self, host, port):
+        self.lock = threading.Lock()
+        self.clients = {}    # socket -> [filters]
+        self.retained = {}
+        self.server = socket.create_server((host, port))
+        threading.Thread(target=self.accept, daemon=True).start()
+
+    @staticmethod
+    def matches(pattern, topic):
+        p, t = pattern.split("/"), topic.split("/")
+        for i, part in enumerate(p):
+            if part == "#":
+                return True
+            if i >= len(t) or (part != "+" and part != t[i]):
+                return False
+        return len(p) == len(t)
+
+    @staticmethod
+    def packet(kind, body):
+        length, header = len(body), bytearray([kind])
+        while True:
+            byte, length = length % 128, length // 128
+            header.append(byte | (0x80 if length else 0))
+            if not length:
+                return bytes(header) + body
+
+    @staticmethod
+    def string(data, pos):
+        n = struct.unpack_from("!H", data, pos)[0]
+        return data[pos + 2:pos + 2 + n], pos + 2 + n
+
+    def publish_packet(self, topic, payload, retain):
+        body = struct.pack("!H", len(topic)) + topic.encode() + payload
+        return self.packet(0x30 | (1 if retain else 0), body)
+
+    def send(self, sock, data):
+        try:
+            sock.sendall(data)
+        except OSError:
+            pass
+
+    def route(self, topic, payload, retain):
+        with self.lock:
+            if retain:
+                if payload:
+                    self.retained[topic] = payload
+                else:
+                    self.retained.pop(topic, None)
+            targets = [s for s, filters in self.clients.items() if any(self.matches(f, topic) for f in filters)]
+        data = self.publish_packet(topic, payload, False)
+        for sock in targets:
+            self.send(sock, data)
+
+    def accept(self):
+        while True:
+            sock, _ = self.server.accept()
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            threading.Thread(target=self.serve, args=(sock,), daemon=True).start()
+
+    def read(self, sock):
+        def exact(n):
+            data = b""
+            while len(data) < n:
+                chunk = sock.recv(n - len(data))
+                if not chunk:
+                    raise OSError("closed")
+                data += chunk
+            return data
+        kind = exact(1)[0]
+        length, shift = 0, 0
+        while True:
+            byte = exact(1)[0]
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        return kind, exact(length) if length else b""
+
+    def serve(self, sock):
+        will = None
+        try:
+            kind, body = self.read(sock)
+            if kind >> 4 != 1:
+                return
+            _, pos = self.string(body, 0)
+            flags = body[pos + 1]
+            _, pos = self.string(body, pos + 4)           # Client ID
+            if flags & 0x04:
+                will_topic, pos = self.string(body, pos)
+                will_payload, pos = self.string(body, pos)
+                will = (will_topic.decode(), will_payload, bool(flags & 0x20))
+            with self.lock:
+                self.clients[sock] = []
+            self.send(sock, self.packet(0x20, b"\x00\x00"))
+            while True:
+                kind, body = self.read(sock)
+                ptype = kind >> 4
+                if ptype == 3:                                  # PUBLISH (QoS 0)
+                    topic, pos = self.string(body, 0)
+                    self.route(topic.decode(), body[pos:], bool(kind & 1))
+                elif ptype == 8:                                # SUBSCRIBE
+                    packet_id, pos, filters = body[:2], 2, []
+                    while pos < len(body):
+                        topic, pos = self.string(body, pos)
+                        filters.append(topic.decode())
+                        pos += 1
+                    with self.lock:
+                        self.clients[sock].extend(filters)
+                        replay = [(t, p) for t, p in self.retained.items() if any(self.matches(f, t) for f in filters)]
+                    self.send(sock, self.packet(0x90, packet_id + b"\x00" * len(filters)))
+                    for topic, payload in replay:
+                        self.send(sock, self.publish_packet(topic, payload, True))
+                elif ptype == 12:                               # PINGREQ
+                    self.send(sock, self.packet(0xD0, b""))
+                elif ptype == 14:                               # DISCONNECT
+                    will = None
+                    return
+        except OSError:
+            pass
+        finally:
+            with self.lock:
+                self.clients.pop(sock, None)
+            sock.close()
+            if will:
+                self.route(*will)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--builtin-broker", action="store_true",
+                        help="run a minimal in-process broker on --host/--port")
+    parser.add_argument("--devices", type=int, default=50)
+    parser.add_argument("--boot-spread", type=float, default=1.0,
+                        help="seconds over which devices come back after the power cut")
+    parser.add_argument("--cold", action="store_true",
+                        help="no stored discovery hash: every device publishes discovery")
+    parser.add_argument("--device-discovery", action="store_true",
+                        help="devices use device-based discovery (HA 2024.11+) instead of per entity")
+    parser.add_argument("--json-state", action="store_true",
+                        help="devices use the single JSON state message")
+    parser.add_argument("--rfid", action="store_true",
+                        help="devices have the RFID reader (scent and cartridge entities)")
+    parser.add_argument("--retained-birth", action="store_true",
+                        help="the broker holds a retained HA birth, replayed on every subscribe")
+    parser.add_argument("--ha-restart", action="store_true",
+                        help="send a Home Assistant birth message once the fleet is up")
+    parser.add_argument("--duration", type=float, default=30.0)
+    args = parser.parse_args()
+
+    if args.builtin_broker:
+        Broker(args.host, args.port)
+
+    stats = Stats()
+    devices = [Device(i, args, stats) for i in range(args.devices)]
+    last_topic = "/state" if args.json_state else devices[0].fields[-1][0]
+    stats.expected = {d.base + last_topic: d.base for d in devices}
+
+    monitor = new_client("fleet-sim-monitor")
+    monitor.on_message = stats.on_message
+    monitor.connect(args.host, args.port)
+    monitor.subscribe("#")
+    monitor.loop_start()
+    if args.retained_birth:
+        monitor.publish(DISCOVERY_PREFIX + "/status", "online", retain=True)
+    time.sleep(0.5)
+    stats.start = time.monotonic()
+
+    # Event loop: connect attempts are scheduled, connected devices loop
+    pending = [(random.uniform(0, args.boot_spread), i) for i in range(args.devices)]
+    heapq.heapify(pending)
+    birth_sent = False
+    end = stats.start + args.duration
+    while time.monotonic() < end:
+        now = time.monotonic() - stats.start
+        while pending and pending[0][0] <= now:
+            _, i = heapq.heappop(pending)
+            retry = devices[i].connect()
+            if retry is not None:
+                heapq.heappush(pending, (now + retry, i))
+        for i, device in enumerate(devices):
+            retry = device.check_refused()
+            if retry is not None:
+                heapq.heappush(pending, (now + retry, i))
+            device.loop()
+        # Restart HA once the fleet is up and past the retained-birth window
+        if (args.ha_restart and not birth_sent and len(stats.complete) == args.devices and
+                now - max(stats.connect_times) > HA_BIRTH_RETAINED):
+            birth_sent = True
+            stats.complete.clear()
+            monitor.publish(DISCOVERY_PREFIX + "/status", "online")
+            print("HA birth sent at %.1fs" % (time.monotonic() - stats.start))
+        time.sleep(LOOP_INTERVAL)
+
+    for device in devices:
+        device.client.loop_stop()
+        device.client.disconnect()
+    if args.retained_birth:
+        monitor.publish(DISCOVERY_PREFIX + "/status", "", retain=True)
+    monitor.loop_stop()
+
+    total = sum(stats.per_second.values())
+    peak = max(stats.per_second.values()) if stats.per_second else 0
+    print("devices:            %d (%s, %s discovery, %s state)"
+          % (args.devices, "cold" if args.cold else "warm", "device" if args.device_discovery else "per-entity",
+             "json" if args.json_state else "per-topic"))
+    print("connected:          %d, failed attempts %d" % (len(stats.connect_times), stats.failures))
+    print("messages:           %d (%.1f KB), peak %d msg/s" % (total, stats.bytes / 1024.0, peak))
+    if args.retained_birth:
+        print("retained births:    %d ignored" % stats.births_ignored)
+    if len(stats.complete) == args.devices:
+        print("all state visible:  %.2fs" % max(stats.complete.values()))
+    else:
+        print("state visible:      %d of %d devices" % (len(stats.complete), args.devices))
+    steps = [d for d in devices if d.steps]
+    if steps:
+        per_step = sorted(d.step_time / d.steps * 1e3 for d in steps)
+        print("host ms per publish step (paho, not device CPU): median %.3f, max %.3f"
+              % (per_step[len(per_step) // 2], per_step[-1]))
+
+
+if __name__ == "__main__":
+    main()